@@ -27,19 +27,19 @@
 #include "fwdtapp.h"
 #include "fwdt.h"
 
-int get_ec_register(int fd, u8 addr, u8* val) {
-	int err;
+int get_ec_registers(int fd, u8* val) {
 	long ioret;
-	struct fwdt_ec_data fec;
+	struct fwdt_ec_block feb;
 
-	fec.parameters.func = GET_EC_REGISTER;
-	fec.address = addr;
+	feb.parameters.func = GET_EC_BLOCK;
+	feb.address = 0;
+	feb.length = FWDT_EC_SIZE;
 
-	ioret = ioctl(fd, FWDT_ACPI_EC_CMD, &fec);
+	ioret = ioctl(fd, FWDT_ACPI_EC_BLOCK_CMD, &feb);
 	if (ioret)
 		return FWDT_FAIL;
 
-	*val = fec.data;
+	memcpy(val, feb.data, FWDT_EC_SIZE);
 
 	return 0;
 }
@@ -47,7 +47,7 @@ int get_ec_register(int fd, u8 addr, u8* val) {
 int main(void) {
 	int err, i;
 	int fd;
-	u8 ec_reg;
+	u8 ec_reg[FWDT_EC_SIZE];
 
 	err = 0;
 
@@ -58,11 +58,16 @@ int main(void) {
 	}
 
 	printf("Loading embedded controlled's registers:\n");
-	for (i = 0; i < 256; i++) {
-		err = get_ec_register(fd, i, &ec_reg);
-		printf("\tEC register 0x%02x = 0x%02x\n", i, ec_reg);
+	err = get_ec_registers(fd, ec_reg);
+	if (err) {
+		printf("Cannot read EC registers. Aborted.\n");
+		close(fd);
+		return err;
 	}
 
+	for (i = 0; i < FWDT_EC_SIZE; i++)
+		printf("\tEC register 0x%02x = 0x%02x\n", i, ec_reg[i]);
+
 	close(fd);
 
 	return err;
@@ -11,7 +11,7 @@
 # MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
 # GNU General Public License for more details.
 
-import os, sys, fcntl, array, argparse
+import os, sys, fcntl, array, argparse, ctypes, errno
 
 from struct import *
 
@@ -99,6 +99,39 @@ class FWDT_IOMEM(FWDT_Obj):
     def write_data(self, data):
         self.write_sysfs(self.data, data)
 
+class FWDT_MEM(FWDT_Obj):
+    def __init__(self):
+        FWDT_Obj.__init__(self)
+        self.window = os.path.join(self.sys, 'mem_window')
+
+    def read(self, addr, length):
+        ''' sysfs returns at most a page per read '''
+        data = b''
+        fd = os.open(self.window, os.O_RDONLY)
+        while len(data) < length:
+            chunk = os.pread(fd, length - len(data), addr + len(data))
+            if not chunk:
+                break
+            data += chunk
+        os.close(fd)
+        if len(data) < length:
+            print("short read: %d of %d bytes at 0x%x" % (len(data), length, addr),
+                  file=sys.stderr)
+        return data
+
+    def write(self, addr, data):
+        done = 0
+        fd = os.open(self.window, os.O_WRONLY)
+        while done < len(data):
+            n = os.pwrite(fd, data[done:], addr + done)
+            if n <= 0:
+                break
+            done += n
+        os.close(fd)
+        if done < len(data):
+            print("short write: %d of %d bytes at 0x%x" % (done, len(data), addr),
+                  file=sys.stderr)
+
 class FWDT_EC(FWDT_IOMEM):
     def __init__(self, address, data):
         FWDT_Obj.__init__(self)
@@ -151,6 +184,8 @@ class FWDT_DEV(object):
             return _IOWR(ord('p'), 1, 1288)
         if cmd == 'io':
             return _IOWR(ord('p'), 2, 8)
+        if cmd == 'io_dword':
+            return _IOWR(ord('p'), 0x0D, 12)
         if cmd == 'memory':
             return _IOWR(ord('p'), 3, 16)
         if cmd == 'cmos':
@@ -158,7 +193,7 @@ class FWDT_DEV(object):
         if cmd == 'ec':
             return _IOWR(ord('p'), 5, 6)
         if cmd == 'acpi':
-            return _IOWR(ord('p'), 6, 272)
+            return _IOWR(ord('p'), 6, 292)
         return -1
 
     def cmosRead(self, addr):
@@ -170,18 +205,25 @@ class FWDT_DEV(object):
 
     def ioReadByte(self, addr):
         file = open(self.dev)
-        buf = array.array('B', pack('HHHB', 1, 0, addr, 0))
+        buf = array.array('B', pack('<HHHH', 1, 0, addr, 0))
         fcntl.ioctl(file, self.getIoNum('io'), buf, 1)
         file.close
         return buf[6]
 
     def ioReadWord(self, addr):
         file = open(self.dev)
-        buf = array.array('B', pack('HHHH', 3, 0, addr, 0))
+        buf = array.array('B', pack('<HHHH', 3, 0, addr, 0))
         fcntl.ioctl(file, self.getIoNum('io'), buf, 1)
         file.close
         return buf[6] + (buf[7] << 8)
 
+    def ioReadDword(self, addr):
+        file = open(self.dev)
+        buf = array.array('B', pack('<HHHHI', 5, 0, addr, 0, 0))
+        fcntl.ioctl(file, self.getIoNum('io_dword'), buf, 1)
+        file.close
+        return unpack('<I', buf[8:12])[0]
+
     def ecCheck(self):
         present = False
         file = open(self.dev)
@@ -199,6 +241,80 @@ class FWDT_DEV(object):
         file.close
         return buf[5]
 
+    def acpiEncode(self, obj):
+        ''' serialize an int, str, bytes or list as a fwdt_acpi_object '''
+        if isinstance(obj, int):
+            return pack('<HHIQ', 1, 0, 8, obj & 0xFFFFFFFFFFFFFFFF)
+        if isinstance(obj, str):
+            data = obj.encode()
+            return pack('<HHI', 2, 0, len(data)) + data
+        if isinstance(obj, (bytes, bytearray)):
+            return pack('<HHI', 3, 0, len(obj)) + bytes(obj)
+        if isinstance(obj, list):
+            return pack('<HHI', 4, 0, len(obj)) + b''.join(self.acpiEncode(o) for o in obj)
+        raise TypeError("cannot encode %r as an ACPI object" % obj)
+
+    def acpiDecode(self, data, pos=0):
+        ''' return the object serialized at pos and the offset after it '''
+        type, reserved, length = unpack_from('<HHI', data, pos)
+        pos += 8
+        if type == 1:
+            return unpack_from('<Q', data, pos)[0], pos + 8
+        if type == 4:
+            elements = []
+            for i in range(length):
+                obj, pos = self.acpiDecode(data, pos)
+                elements.append(obj)
+            return elements, pos
+        payload = bytes(data[pos:pos + length])
+        if type == 2 or type == 0x14:
+            return payload.decode(errors='replace'), pos + length
+        if type == 3:
+            return payload, pos + length
+        return None, pos + length
+
+    def acpiEvaluate(self, path, objs, result_size=4096):
+        args = b''.join(self.acpiEncode(o) for o in objs)
+        abuf = ctypes.create_string_buffer(args, max(len(args), 1))
+        while True:
+            rbuf = ctypes.create_string_buffer(result_size)
+            buf = array.array('B', pack('<HH256sIIQIIQ', 1, 0, path.encode(),
+                                        len(objs), len(args), ctypes.addressof(abuf),
+                                        result_size, 0, ctypes.addressof(rbuf)))
+            file = open(self.dev)
+            try:
+                fcntl.ioctl(file, self.getIoNum('acpi'), buf, 1)
+            except OSError as e:
+                if e.errno != errno.ENOSPC or result_size >= (1 << 20):
+                    raise
+                result_size *= 4
+                continue
+            finally:
+                file.close()
+            break
+        size = unpack_from('<I', buf, 276)[0]
+        if size == 0:
+            return None
+        return self.acpiDecode(rbuf.raw[:size])[0]
+
+def acpi_format(obj):
+    if isinstance(obj, int):
+        return "0x%x" % obj
+    if isinstance(obj, bytes):
+        return ' '.join('%02x' % b for b in obj)
+    if isinstance(obj, list):
+        return '[' + ', '.join(acpi_format(o) for o in obj) + ']'
+    if obj is None:
+        return "(none)"
+    return '"%s"' % obj
+
+def acpi_arg(arg):
+    ''' integers are taken as numbers, anything else as a string '''
+    try:
+        return int(arg, 0)
+    except ValueError:
+        return arg
+
 def main():
     write_op = False
     parser = argparse.ArgumentParser(description='FWDT utility.')
@@ -208,8 +324,10 @@ def main():
     parser.add_argument("--iob", nargs='+', help="Read & Write I/O byte-access registers")
     parser.add_argument("--iow", nargs='+', help="Read & Write I/O word-access registers")
     parser.add_argument("-m", "--memory", nargs='+', help="Read & Write memory")
+    parser.add_argument("-d", "--dump", nargs=2, help="Dump a memory region (address length)")
     parser.add_argument("--msr", help="Read MSR registers")
     parser.add_argument("-p", "--pci", nargs='+', help="Read & Write PCI registers")
+    parser.add_argument("--aml", nargs='+', help="Evaluate an ACPI object (path [args...])")
 
     args = parser.parse_args()
     if args.msr:
@@ -269,16 +387,28 @@ def main():
             pci.write_data(args.pci[2])
             write_op = True
     elif args.memory:
-        memory = FWDT_IOMEM('mem_address', 'mem_data')
+        memory = FWDT_MEM()
+        addr = int(args.memory[0], 16)
         if len(args.memory) == 1:
             ''' read from memory '''
-            memory.write_address(args.memory[0])
-            val = memory.read_data()
+            val = "0x%08x" % unpack('<I', memory.read(addr, 4))[0]
         elif len(args.memory) == 2:
             ''' Write to memory '''
-            memory.write_address(args.memory[0])
-            memory.write_data(args.memory[1])
+            memory.write(addr, pack('<I', int(args.memory[1], 16)))
             write_op = True
+    elif args.dump:
+        memory = FWDT_MEM()
+        addr = int(args.dump[0], 16)
+        data = memory.read(addr, int(args.dump[1], 0))
+        lines = []
+        for i in range(0, len(data), 16):
+            line = ' '.join('%02x' % b for b in data[i:i + 16])
+            lines.append("%016x: %s" % (addr + i, line))
+        val = '\n'.join(lines)
+    elif args.aml:
+        dev = FWDT_DEV()
+        result = dev.acpiEvaluate(args.aml[0], [acpi_arg(a) for a in args.aml[1:]])
+        val = acpi_format(result)
 
 
     if not write_op:
@@ -27,19 +27,19 @@
 #include "fwdtapp.h"
 #include "fwdt.h"
 
-int get_cmos_register(int fd, u8 addr, u8* val) {
-	int err;
+int get_cmos_registers(int fd, u8 addr, u8 len, u8* val) {
 	long ioret;
-	struct fwdt_cmos_data fc;
+	struct fwdt_cmos_block fc;
 
-	fc.parameters.func = GET_DATA_BYTE;
+	fc.parameters.func = GET_DATA_BLOCK;
 	fc.cmos_address = addr;
+	fc.length = len;
 
-	ioret = ioctl(fd, FWDT_HW_ACCESS_CMOS_CMD, &fc);
+	ioret = ioctl(fd, FWDT_HW_ACCESS_CMOS_BLOCK_CMD, &fc);
 	if (ioret)
 		return FWDT_FAIL;
 
-	*val = fc.cmos_data;
+	memcpy(val, fc.data + addr, len);
 
 	return 0;
 }
@@ -47,8 +47,8 @@ int get_cmos_register(int fd, u8 addr, u8* val) {
 int main(void) {
 	int err;
 	int fd;
-	u8 cmos_data;
-	int i;
+	u8 cmos_data[4];
+	unsigned int i;
 
 	err = 0;
 
@@ -59,11 +59,17 @@ int main(void) {
 	}
 
 	printf("hp laptop debugging info:\n");
-	for (i = 0x70; i < 0x74; i++) {
-		err = get_cmos_register(fd, i, &cmos_data);
-		printf("\tCMOS register 0x%02x = 0x%02x\n", i, cmos_data);
+	err = get_cmos_registers(fd, 0x70, sizeof(cmos_data), cmos_data);
+	if (err) {
+		printf("Cannot read CMOS registers.\n");
+		close(fd);
+		return err;
 	}
 
+	for (i = 0; i < sizeof(cmos_data); i++)
+		printf("\tCMOS register 0x%02x = 0x%02x\n", 0x70 + i,
+		       cmos_data[i]);
+
 	close(fd);
 
 	return err;
@@ -29,6 +29,13 @@ enum fwdt_acpi_ec_sub_cmd {
 	SET_EC_REGISTER = 0x02,
 	CALL_EC_QMETHOD = 0x03,
 	CHECK_EC_DEVICE = 0x04,
+	GET_EC_BLOCK = 0x05,
+	SET_EC_BLOCK = 0x06,
+	UPDATE_EC_REGISTER = 0x07,
+};
+
+enum fwdt_acpi_aml_sub_cmd {
+	EVALUATE_ACPI_OBJECT = 0x01,
 };
 
 enum fwdt_hw_access_sub_cmd {
@@ -38,6 +45,52 @@ enum fwdt_hw_access_sub_cmd {
 	SET_DATA_WORD = 0x04,
 	GET_DATA_DWORD = 0x05,
 	SET_DATA_DWORD = 0x06,
+	GET_DATA_BLOCK = 0x07,
+	SET_DATA_BLOCK = 0x08,
+};
+
+enum fwdt_mem_map_sub_cmd {
+	GET_CACHE_MODE = 0x01,
+	SET_CACHE_MODE = 0x02,
+};
+
+enum fwdt_mem_snapshot_sub_cmd {
+	CAPTURE_SNAPSHOT = 0x01,
+	DIFF_SNAPSHOT = 0x02,
+	RELEASE_SNAPSHOT = 0x03,
+};
+
+enum fwdt_pci_cap_sub_cmd {
+	GET_CAP_LIST = 0x01,
+	GET_CAP_FIELD = 0x02,
+	SET_CAP_FIELD = 0x03,
+};
+
+enum fwdt_pci_bar_sub_cmd {
+	READ_BAR = 0x01,
+	WRITE_BAR = 0x02,
+	POLL_BAR = 0x03,
+};
+
+enum fwdt_mem_cache_mode {
+	FWDT_CACHE_UC = 0x00,
+	FWDT_CACHE_WC = 0x01,
+	FWDT_CACHE_WB = 0x02,
+};
+
+enum fwdt_msr_sub_cmd {
+	READ_MSR = 0x01,
+	WRITE_MSR = 0x02,
+	START_MSR_SAMPLER = 0x03,
+	STOP_MSR_SAMPLER = 0x04,
+};
+
+enum fwdt_batch_op_type {
+	FWDT_BATCH_IO = 0x01,
+	FWDT_BATCH_MEMORY = 0x02,
+	FWDT_BATCH_CMOS = 0x03,
+	FWDT_BATCH_EC = 0x04,
+	FWDT_BATCH_PCI = 0x05,
 };
 
 typedef struct {
@@ -67,18 +120,140 @@ struct fwdt_io_data {
 	};
 } __attribute__((packed));
 
+/* GET_DATA_DWORD / SET_DATA_DWORD, kept apart to leave fwdt_io_data as is */
+struct fwdt_io_dword_data {
+	fwdt_parameter parameters;
+	u16 io_address;
+	u16 reserved;
+	u32 io_dword;
+} __attribute__((packed));
+
+#define FWDT_IO_BLOCK_MAX (64 * 1024)
+
+/* Step to the next port after every element instead of repeating one port */
+#define FWDT_IO_INCREMENT 0x01
+
+/* buffer holds count elements of width bytes (1, 2 or 4) */
+struct fwdt_io_block {
+	fwdt_parameter parameters;
+	u16 io_address;
+	u8 width;
+	u8 flags;
+	u32 count;
+	u64 buffer;
+} __attribute__((packed));
+
+#define FWDT_IO_INDEX_MAX 256
+
+/*
+ * Index/data register pair access. Each entry of indices (or of the range
+ * first_index .. first_index + count - 1 when indices is 0) is written to
+ * index_port before its data is transferred through data_port. buffer holds
+ * one u32 per index whatever data_width is. PCI config space cannot be
+ * reached through 0xCF8/0xCFC here, use the PCI ioctls instead.
+ */
+struct fwdt_io_index {
+	fwdt_parameter parameters;
+	u16 index_port;
+	u16 data_port;
+	u8 index_width;
+	u8 data_width;
+	u16 reserved;
+	u32 first_index;
+	u32 count;
+	u64 indices;
+	u64 buffer;
+} __attribute__((packed));
+
 struct fwdt_mem_data {
 	fwdt_parameter parameters;
 	u64 mem_address;
 	u32 mem_data;
 } __attribute__((packed));
 
+#define FWDT_MEM_BLOCK_MAX (16 * 1024 * 1024)
+
+/* width is the access size in bytes (1, 2, 4, 8), or 0 for memcpy */
+struct fwdt_mem_block {
+	fwdt_parameter parameters;
+	u64 mem_address;
+	u32 length;
+	u32 width;
+	u64 buffer;
+} __attribute__((packed));
+
+#define FWDT_MEM_SCAN_PATTERN_MAX 16
+
+/* hits receives the physical address of every match, up to max_hits */
+struct fwdt_mem_scan {
+	fwdt_parameter parameters;
+	u64 mem_address;
+	u64 length;
+	u8 pattern[FWDT_MEM_SCAN_PATTERN_MAX];
+	u32 pattern_len;
+	u32 align;
+	u32 max_hits;
+	u32 num_hits;
+	u64 hits;
+} __attribute__((packed));
+
+#define FWDT_MEM_SNAPSHOT_MAX (16 * 1024 * 1024)
+
+/* per-open limits on live snapshots, CAPTURE_SNAPSHOT fails with ENOSPC */
+#define FWDT_MEM_SNAPSHOT_COUNT 64
+#define FWDT_MEM_SNAPSHOT_TOTAL (64 * 1024 * 1024)
+
+/* DIFF_SNAPSHOT replaces the captured data with the current contents */
+#define FWDT_SNAPSHOT_UPDATE 0x01
+
+struct fwdt_mem_change {
+	u64 offset;
+	u64 old_data;
+	u64 new_data;
+} __attribute__((packed));
+
+/*
+ * Snapshots are compared in 64-bit words, so length must be a multiple of 8.
+ * Memory is captured with 32-bit reads, so mem_address must be 4-byte aligned.
+ * num_changes reports every changed word even when only max_changes of them
+ * fit in changes.
+ */
+struct fwdt_mem_snapshot {
+	fwdt_parameter parameters;
+	u32 handle;
+	u32 flags;
+	u64 mem_address;
+	u64 length;
+	u32 max_changes;
+	u32 num_changes;
+	u64 changes;
+} __attribute__((packed));
+
+/* caching mode applied to later mmap() calls on the same fd */
+struct fwdt_mem_map_data {
+	fwdt_parameter parameters;
+	u32 cache_mode;
+} __attribute__((packed));
+
 struct fwdt_cmos_data {
 	fwdt_parameter parameters;
 	u8 cmos_address;
 	u8 cmos_data;
 } __attribute__((packed));
 
+#define FWDT_CMOS_SIZE 256
+
+/*
+ * data mirrors the whole NVRAM (standard bank at 0x00-0x7f, extended bank at
+ * 0x80-0xff); only [cmos_address, cmos_address + length) is transferred.
+ */
+struct fwdt_cmos_block {
+	fwdt_parameter parameters;
+	u16 cmos_address;
+	u16 length;
+	u8 data[FWDT_CMOS_SIZE];
+} __attribute__((packed));
+
 struct fwdt_ec_data {
 	fwdt_parameter parameters;
 	union {
@@ -88,18 +263,295 @@ struct fwdt_ec_data {
 	u8 data;
 } __attribute__((packed));
 
+#define FWDT_EC_SIZE 256
+
+/* data mirrors the EC space; only [address, address + length) moves */
+struct fwdt_ec_block {
+	fwdt_parameter parameters;
+	u8 address;
+	u8 reserved;
+	u16 length;
+	u8 data[FWDT_EC_SIZE];
+} __attribute__((packed));
+
+#define FWDT_EC_UPDATE_MAX 256
+
+/* new_data = (old_data & and_mask) | or_mask */
+struct fwdt_ec_mask_op {
+	u8 address;
+	u8 and_mask;
+	u8 or_mask;
+	u8 old_data;
+	u8 new_data;
+	u8 reserved[3];
+} __attribute__((packed));
+
+/* count is updated to the number of ops applied */
+struct fwdt_ec_update {
+	fwdt_parameter parameters;
+	u32 count;
+	u32 reserved;
+	u64 updates;
+} __attribute__((packed));
+
+/* Records read from /dev/fwdt_ec_events, timestamp is ktime in ns */
+struct fwdt_ec_event {
+	u64 timestamp;
+	u8 query;
+	u8 reserved[7];
+} __attribute__((packed));
+
+struct fwdt_msr_value {
+	u64 value;
+	s32 err;
+	u32 reserved;
+} __attribute__((packed));
+
+/*
+ * cpumask is a CPU bitmap of mask_size bytes. values holds num_cpus entries
+ * indexed by CPU number; entries of CPUs outside the mask are left alone.
+ */
+struct fwdt_msr_data {
+	fwdt_parameter parameters;
+	u32 msr;
+	u32 mask_size;
+	u64 cpumask;
+	u32 num_cpus;
+	u32 reserved;
+	u64 values;
+} __attribute__((packed));
+
+#define FWDT_MSR_LIST_MAX 32
+
+/*
+ * Read num_msrs MSRs on every CPU in cpumask. values is a num_cpus by
+ * num_msrs matrix with one row per CPU number, in the order of msrs.
+ */
+struct fwdt_msr_list {
+	fwdt_parameter parameters;
+	u32 num_msrs;
+	u32 mask_size;
+	u64 msrs;
+	u64 cpumask;
+	u32 num_cpus;
+	u32 reserved;
+	u64 values;
+} __attribute__((packed));
+
+#define FWDT_MSR_SAMPLE_MAX 8
+#define FWDT_MSR_SAMPLER_MIN_PERIOD 100000
+#define FWDT_MSR_SAMPLER_RING_SIZE 4096
+#define FWDT_MSR_SAMPLER_RING_MAX 65536
+
+/*
+ * Sample num_msrs MSRs every period_ns on each CPU in cpumask. ring_size
+ * is the per-CPU sample count, a power of two; 0 selects the default.
+ */
+struct fwdt_msr_sampler {
+	fwdt_parameter parameters;
+	u32 num_msrs;
+	u32 mask_size;
+	u32 msrs[FWDT_MSR_SAMPLE_MAX];
+	u64 cpumask;
+	u64 period_ns;
+	u32 ring_size;
+	u32 reserved;
+} __attribute__((packed));
+
+/*
+ * Records read from /dev/fwdt_msr_samples, timestamp is ktime in ns and
+ * bit n of err_mask is set when msrs[n] could not be read.
+ */
+struct fwdt_msr_sample {
+	u64 timestamp;
+	u32 cpu;
+	u32 err_mask;
+	u64 values[FWDT_MSR_SAMPLE_MAX];
+} __attribute__((packed));
+
+#define FWDT_PCI_CONFIG_MAX 4096
+#define FWDT_PCI_ECAM 0x01
+
+/*
+ * Copy length bytes of config space at offset of segment:bus:devfn to or
+ * from buffer. width is the access size in bytes (1, 2, 4); offset and
+ * length must be multiples of it. FWDT_PCI_ECAM in flags reads through
+ * the MCFG window where possible; writes always go through the PCI core.
+ */
+struct fwdt_pci_config {
+	fwdt_parameter parameters;
+	u16 segment;
+	u8 bus;
+	u8 devfn;
+	u16 offset;
+	u16 length;
+	u8 width;
+	u8 flags;
+	u16 reserved;
+	u64 buffer;
+} __attribute__((packed));
+
+/*
+ * Dump config_size bytes (64, 256 or 4096) of every PCI function. buffer
+ * receives a fwdt_pci_record per function, each followed by its
+ * config_size bytes, clipped to the function's config space. length is
+ * the buffer size on input and the bytes used on output; when it is too
+ * small the call fails with ENOSPC and length reports the size needed.
+ * flags takes FWDT_PCI_ECAM as for fwdt_pci_config.
+ */
+struct fwdt_pci_inventory {
+	fwdt_parameter parameters;
+	u32 config_size;
+	u32 num_devices;
+	u32 flags;
+	u32 reserved;
+	u64 length;
+	u64 buffer;
+} __attribute__((packed));
+
+struct fwdt_pci_record {
+	u16 segment;
+	u8 bus;
+	u8 devfn;
+	u16 config_size;
+	u16 reserved;
+} __attribute__((packed));
+
+#define FWDT_PCI_CAP_EXTENDED 0x01
+#define FWDT_PCI_CAP_MAX 1024
+
+/* Directory entry, offset is the capability's position in config space */
+struct fwdt_pci_cap_entry {
+	u16 cap_id;
+	u8 flags;
+	u8 version;
+	u16 offset;
+	u16 reserved;
+} __attribute__((packed));
+
+/*
+ * Field of the first capability cap_id (extended when flags has
+ * FWDT_PCI_CAP_EXTENDED) of one function, offset relative to the
+ * capability and width in bytes (1, 2, 4).
+ */
+struct fwdt_pci_cap_access {
+	u16 segment;
+	u8 bus;
+	u8 devfn;
+	u16 cap_id;
+	u8 flags;
+	u8 width;
+	u16 offset;
+	u16 reserved;
+	s32 status;
+	u32 data;
+} __attribute__((packed));
+
+/*
+ * GET_CAP_LIST fills buffer with up to count fwdt_pci_cap_entry of
+ * segment:bus:devfn and sets count to the number found. GET_CAP_FIELD
+ * and SET_CAP_FIELD run count fwdt_pci_cap_access from buffer and set
+ * status of each.
+ */
+struct fwdt_pci_cap_data {
+	fwdt_parameter parameters;
+	u16 segment;
+	u8 bus;
+	u8 devfn;
+	u32 count;
+	u64 buffer;
+} __attribute__((packed));
+
+#define FWDT_PCI_BAR_MAX (16 * 1024 * 1024)
+#define FWDT_PCI_BAR_POLL_MAX 1000000
+
+/*
+ * Access BAR bar of segment:bus:devfn at offset with width-sized (1, 2, 4,
+ * 8) accesses. READ_BAR and WRITE_BAR copy length bytes to or from buffer.
+ * POLL_BAR reads one register until (data & mask) == value or timeout_us
+ * expires, returning the last value read in data. timeout_us is at most
+ * FWDT_PCI_BAR_POLL_MAX.
+ */
+struct fwdt_pci_bar {
+	fwdt_parameter parameters;
+	u16 segment;
+	u8 bus;
+	u8 devfn;
+	u8 bar;
+	u8 width;
+	u16 reserved;
+	u32 length;
+	u32 timeout_us;
+	u64 offset;
+	u64 buffer;
+	u64 mask;
+	u64 value;
+	u64 data;
+} __attribute__((packed));
+
+#define FWDT_ACPI_ARGS_MAX (64 * 1024)
+
+/*
+ * ACPI objects are serialized as a fwdt_acpi_object header followed by
+ * its payload, with no padding. type is the ACPI type: integer (1) has an
+ * 8-byte payload, string (2) and buffer (3) have length bytes, package
+ * (4) is followed by length element objects and a reference (0x14) to a
+ * namespace node carries its absolute path as length bytes. Other types
+ * have no payload. args must hold exactly num_args objects. Arguments and
+ * results nested too deeply are rejected.
+ */
+struct fwdt_acpi_object {
+	u16 type;
+	u16 reserved;
+	u32 length;
+} __attribute__((packed));
+
+/*
+ * Evaluate the object at the absolute path acpi_path with num_args
+ * serialized objects from args. result_size is the size of the result
+ * buffer on input and the size of the serialized result on output, 0
+ * when nothing was returned; when the buffer is too small the call fails
+ * with ENOSPC and result_size reports the size needed.
+ */
 struct fwdt_acpi_data {
 	fwdt_parameter parameters;
 	char acpi_path[256];
-	u32 para1;
-	u32 para2;
-	u32 retVal;
+	u32 num_args;
+	u32 args_size;
+	u64 args;
+	u32 result_size;
+	u32 reserved;
+	u64 result;
 } __attribute__((packed));
 
 typedef struct {
 	fwdt_parameter parameters;
 } fwdt_generic;
 
+/* PCI addresses use the ECAM layout: segment in the upper 32 bits */
+#define FWDT_PCI_ADDRESS(seg, bus, dev, fn, reg)                               \
+	(((u64)(seg) << 32) | ((u64)(bus) << 20) | ((u64)(dev) << 15) |        \
+	 ((u64)(fn) << 12) | (u64)(reg))
+
+#define FWDT_BATCH_STOP_ON_ERROR 0x01
+#define FWDT_BATCH_MAX_OPS 4096
+
+/* func takes GET_DATA_* / SET_DATA_* for every op type */
+struct fwdt_batch_op {
+	u16 type;
+	u16 func;
+	s32 status;
+	u64 address;
+	u64 data;
+} __attribute__((packed));
+
+struct fwdt_batch_data {
+	fwdt_parameter parameters;
+	u32 flags;
+	u32 count;
+	u64 ops;
+} __attribute__((packed));
+
 #define FWDT_ACPI_VGA_CMD _IOWR('p', 0x01, struct fwdt_brightness)
 
 #define FWDT_HW_ACCESS_IO_CMD _IOWR('p', 0x02, struct fwdt_io_data)
@@ -112,4 +564,40 @@ typedef struct {
 
 #define FWDT_ACPI_AML_CMD _IOWR('p', 0x06, struct fwdt_acpi_data)
 
+#define FWDT_BATCH_CMD _IOWR('p', 0x07, struct fwdt_batch_data)
+
+#define FWDT_MEM_MAP_CMD _IOWR('p', 0x08, struct fwdt_mem_map_data)
+
+#define FWDT_HW_ACCESS_MEMORY_BLOCK_CMD _IOWR('p', 0x09, struct fwdt_mem_block)
+
+#define FWDT_MEM_SCAN_CMD _IOWR('p', 0x0A, struct fwdt_mem_scan)
+
+#define FWDT_MEM_SNAPSHOT_CMD _IOWR('p', 0x0B, struct fwdt_mem_snapshot)
+
+#define FWDT_HW_ACCESS_IO_BLOCK_CMD _IOWR('p', 0x0C, struct fwdt_io_block)
+
+#define FWDT_HW_ACCESS_IO_DWORD_CMD _IOWR('p', 0x0D, struct fwdt_io_dword_data)
+
+#define FWDT_HW_ACCESS_IO_INDEX_CMD _IOWR('p', 0x0E, struct fwdt_io_index)
+
+#define FWDT_HW_ACCESS_CMOS_BLOCK_CMD _IOWR('p', 0x0F, struct fwdt_cmos_block)
+
+#define FWDT_ACPI_EC_BLOCK_CMD _IOWR('p', 0x10, struct fwdt_ec_block)
+
+#define FWDT_ACPI_EC_UPDATE_CMD _IOWR('p', 0x11, struct fwdt_ec_update)
+
+#define FWDT_MSR_CMD _IOWR('p', 0x12, struct fwdt_msr_data)
+
+#define FWDT_MSR_LIST_CMD _IOWR('p', 0x13, struct fwdt_msr_list)
+
+#define FWDT_MSR_SAMPLER_CMD _IOWR('p', 0x14, struct fwdt_msr_sampler)
+
+#define FWDT_PCI_CONFIG_CMD _IOWR('p', 0x15, struct fwdt_pci_config)
+
+#define FWDT_PCI_INVENTORY_CMD _IOWR('p', 0x16, struct fwdt_pci_inventory)
+
+#define FWDT_PCI_CAP_CMD _IOWR('p', 0x17, struct fwdt_pci_cap_data)
+
+#define FWDT_PCI_BAR_CMD _IOWR('p', 0x18, struct fwdt_pci_bar)
+
 #endif
@@ -20,9 +20,13 @@
 #include <acpi/acpi_bus.h>
 #include <linux/acpi.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
 #include <linux/platform_device.h>
 #include <linux/semaphore.h>
 #include <linux/uaccess.h>
+#include <asm/unaligned.h>
 
 #ifdef CONFIG_ACPI
 
@@ -59,7 +63,7 @@ ssize_t acpi_method_0_0_write(struct device *dev, struct device_attribute *attr,
 		goto err;
 	}
 
-	status = acpi_evaluate_object(NULL, path, NULL, NULL);
+	status = acpi_evaluate_object(device, NULL, NULL, NULL);
 	if (ACPI_SUCCESS(status))
 		printk("Executed %s\n", path);
 	else
@@ -69,18 +73,24 @@ err:
 	return count;
 }
 
+static DEFINE_MUTEX(fwdt_acpi_lock);
 static char acpi_method_name[80];
 ssize_t acpi_method_0_1_read(struct device *dev, struct device_attribute *attr,
 			     char *buf)
 {
+	acpi_handle device;
 	acpi_status status;
 	unsigned long long output;
 
-	status = acpi_evaluate_integer(NULL, acpi_method_name, NULL, &output);
+	mutex_lock(&fwdt_acpi_lock);
+	status = acpi_get_handle(NULL, acpi_method_name, &device);
+	if (ACPI_SUCCESS(status))
+		status = acpi_evaluate_integer(device, NULL, NULL, &output);
 	if (ACPI_SUCCESS(status))
 		printk("Executed %s\n", acpi_method_name);
 	else
 		printk("Failed to execute %s\n", acpi_method_name);
+	mutex_unlock(&fwdt_acpi_lock);
 
 	return sprintf(buf, "0x%08llx\n", output);
 }
@@ -89,13 +99,21 @@ static u32 acpi_arg0;
 ssize_t acpi_arg0_read(struct device *dev, struct device_attribute *attr,
 		       char *buf)
 {
-	return sprintf(buf, "0x%08x\n", acpi_arg0);
+	u32 arg;
+
+	mutex_lock(&fwdt_acpi_lock);
+	arg = acpi_arg0;
+	mutex_unlock(&fwdt_acpi_lock);
+
+	return sprintf(buf, "0x%08x\n", arg);
 }
 
 ssize_t acpi_arg0_write(struct device *dev, struct device_attribute *attr,
 			const char *buf, size_t count)
 {
+	mutex_lock(&fwdt_acpi_lock);
 	acpi_arg0 = simple_strtoul(buf, NULL, 16);
+	mutex_unlock(&fwdt_acpi_lock);
 
 	return count;
 }
@@ -104,13 +122,21 @@ static u32 acpi_arg1;
 ssize_t acpi_arg1_read(struct device *dev, struct device_attribute *attr,
 		       char *buf)
 {
-	return sprintf(buf, "0x%08x\n", acpi_arg1);
+	u32 arg;
+
+	mutex_lock(&fwdt_acpi_lock);
+	arg = acpi_arg1;
+	mutex_unlock(&fwdt_acpi_lock);
+
+	return sprintf(buf, "0x%08x\n", arg);
 }
 
 ssize_t acpi_arg1_write(struct device *dev, struct device_attribute *attr,
 			const char *buf, size_t count)
 {
+	mutex_lock(&fwdt_acpi_lock);
 	acpi_arg1 = simple_strtoul(buf, NULL, 16);
+	mutex_unlock(&fwdt_acpi_lock);
 
 	return count;
 }
@@ -118,13 +144,18 @@ ssize_t acpi_arg1_write(struct device *dev, struct device_attribute *attr,
 ssize_t acpi_method_1_0_read(struct device *dev, struct device_attribute *attr,
 			     char *buf)
 {
+	acpi_handle device;
 	acpi_status status;
 
-	status = acpi_execute_simple_method(NULL, acpi_method_name, acpi_arg0);
+	mutex_lock(&fwdt_acpi_lock);
+	status = acpi_get_handle(NULL, acpi_method_name, &device);
+	if (ACPI_SUCCESS(status))
+		status = acpi_execute_simple_method(device, NULL, acpi_arg0);
 	if (ACPI_SUCCESS(status))
 		printk("Executed %s\n", acpi_method_name);
 	else
 		printk("Failed to execute %s\n", acpi_method_name);
+	mutex_unlock(&fwdt_acpi_lock);
 
 	return sprintf(buf, "0x%08x\n", ACPI_SUCCESS(status));
 }
@@ -136,12 +167,14 @@ ssize_t acpi_method_name_write(struct device *dev,
 	acpi_handle device;
 	acpi_status status;
 
+	mutex_lock(&fwdt_acpi_lock);
 	acpi_device_path(buf, acpi_method_name);
 
 	status = acpi_get_handle(NULL, acpi_method_name, &device);
 	if (!ACPI_SUCCESS(status)) {
 		printk("Failed to find acpi method: %s\n", acpi_method_name);
 	}
+	mutex_unlock(&fwdt_acpi_lock);
 
 	return count;
 }
@@ -149,18 +182,23 @@ ssize_t acpi_method_name_write(struct device *dev,
 ssize_t acpi_method_1_1_read(struct device *dev, struct device_attribute *attr,
 			     char *buf)
 {
+	acpi_handle device;
 	acpi_status status;
 	unsigned long long output;
 	union acpi_object arg0 = {ACPI_TYPE_INTEGER};
 	struct acpi_object_list args = {1, &arg0};
 
+	mutex_lock(&fwdt_acpi_lock);
 	arg0.integer.value = acpi_arg0;
 
-	status = acpi_evaluate_integer(NULL, acpi_method_name, &args, &output);
+	status = acpi_get_handle(NULL, acpi_method_name, &device);
+	if (ACPI_SUCCESS(status))
+		status = acpi_evaluate_integer(device, NULL, &args, &output);
 	if (ACPI_SUCCESS(status))
 		printk("Executed %s\n", acpi_method_name);
 	else
 		printk("Failed to execute %s\n", acpi_method_name);
+	mutex_unlock(&fwdt_acpi_lock);
 
 	return sprintf(buf, "0x%08llx\n", output);
 }
@@ -168,20 +206,25 @@ ssize_t acpi_method_1_1_read(struct device *dev, struct device_attribute *attr,
 ssize_t acpi_method_2_0_read(struct device *dev, struct device_attribute *attr,
 			     char *buf)
 {
+	acpi_handle device;
 	acpi_status status;
 	unsigned long long output;
 	union acpi_object arg_objs[] = {{ACPI_TYPE_INTEGER},
 					{ACPI_TYPE_INTEGER}};
 	struct acpi_object_list args = {2, arg_objs};
 
+	mutex_lock(&fwdt_acpi_lock);
 	arg_objs[0].integer.value = acpi_arg0;
 	arg_objs[1].integer.value = acpi_arg1;
 
-	status = acpi_evaluate_integer(NULL, acpi_method_name, &args, &output);
+	status = acpi_get_handle(NULL, acpi_method_name, &device);
+	if (ACPI_SUCCESS(status))
+		status = acpi_evaluate_integer(device, NULL, &args, &output);
 	if (ACPI_SUCCESS(status))
 		printk("Executed %s\n", acpi_method_name);
 	else
 		printk("Failed to execute %s\n", acpi_method_name);
+	mutex_unlock(&fwdt_acpi_lock);
 
 	return sprintf(buf, "0x%08x\n", ACPI_SUCCESS(status));
 }
@@ -189,46 +232,293 @@ ssize_t acpi_method_2_0_read(struct device *dev, struct device_attribute *attr,
 ssize_t acpi_method_2_1_read(struct device *dev, struct device_attribute *attr,
 			     char *buf)
 {
+	acpi_handle device;
 	acpi_status status;
 	unsigned long long output;
 	union acpi_object arg_objs[] = {{ACPI_TYPE_INTEGER},
 					{ACPI_TYPE_INTEGER}};
 	struct acpi_object_list args = {2, arg_objs};
 
+	mutex_lock(&fwdt_acpi_lock);
 	arg_objs[0].integer.value = acpi_arg0;
 	arg_objs[1].integer.value = acpi_arg1;
 
-	status = acpi_evaluate_integer(NULL, acpi_method_name, &args, &output);
+	status = acpi_get_handle(NULL, acpi_method_name, &device);
+	if (ACPI_SUCCESS(status))
+		status = acpi_evaluate_integer(device, NULL, &args, &output);
 	if (ACPI_SUCCESS(status))
 		printk("Executed %s\n", acpi_method_name);
 	else
 		printk("Failed to execute %s\n", acpi_method_name);
+	mutex_unlock(&fwdt_acpi_lock);
 
 	return sprintf(buf, "0x%08llx\n", output);
 }
 
+#define FWDT_ACPI_DEPTH_MAX 8
+#define FWDT_ACPI_PACKAGE_MAX 4096
+
+static void fwdt_acpi_free_object(union acpi_object *obj)
+{
+	u32 i;
+
+	if (obj->type != ACPI_TYPE_PACKAGE)
+		return;
+
+	for (i = 0; i < obj->package.count; i++)
+		fwdt_acpi_free_object(&obj->package.elements[i]);
+	kfree(obj->package.elements);
+}
+
+/*
+ * Decode one serialized argument at *pos. Strings and buffers point into
+ * the argument copy, only package element arrays are allocated. On error
+ * nothing is left allocated for obj.
+ */
+static int fwdt_acpi_decode(const u8 **pos, const u8 *end,
+			    union acpi_object *obj, int depth)
+{
+	struct fwdt_acpi_object hdr;
+	int ret;
+	u32 i;
+
+	if (depth > FWDT_ACPI_DEPTH_MAX || end - *pos < sizeof(hdr))
+		return -EINVAL;
+
+	memcpy(&hdr, *pos, sizeof(hdr));
+	*pos += sizeof(hdr);
+
+	switch (hdr.type) {
+	case ACPI_TYPE_INTEGER:
+		if (hdr.length != sizeof(u64) || end - *pos < sizeof(u64))
+			return -EINVAL;
+		obj->integer.type = ACPI_TYPE_INTEGER;
+		obj->integer.value = get_unaligned((u64 *)*pos);
+		*pos += sizeof(u64);
+		break;
+	case ACPI_TYPE_STRING:
+		if (end - *pos < hdr.length)
+			return -EINVAL;
+		obj->string.type = ACPI_TYPE_STRING;
+		obj->string.length = hdr.length;
+		obj->string.pointer = (char *)*pos;
+		*pos += hdr.length;
+		break;
+	case ACPI_TYPE_BUFFER:
+		if (end - *pos < hdr.length)
+			return -EINVAL;
+		obj->buffer.type = ACPI_TYPE_BUFFER;
+		obj->buffer.length = hdr.length;
+		obj->buffer.pointer = (u8 *)*pos;
+		*pos += hdr.length;
+		break;
+	case ACPI_TYPE_PACKAGE:
+		if (hdr.length > FWDT_ACPI_PACKAGE_MAX)
+			return -EINVAL;
+		obj->package.type = ACPI_TYPE_PACKAGE;
+		obj->package.count = 0;
+		obj->package.elements = kcalloc(hdr.length,
+						sizeof(union acpi_object),
+						GFP_KERNEL);
+		if (!obj->package.elements && hdr.length)
+			return -ENOMEM;
+
+		for (i = 0; i < hdr.length; i++) {
+			ret = fwdt_acpi_decode(pos, end,
+					       &obj->package.elements[i],
+					       depth + 1);
+			if (ret) {
+				fwdt_acpi_free_object(obj);
+				return ret;
+			}
+			obj->package.count++;
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Serialize obj into buf, which has room for space bytes, unless buf is
+ * NULL. Returns the encoded size or a negative error. Results nest no
+ * deeper than the arguments accepted by fwdt_acpi_decode().
+ */
+static ssize_t fwdt_acpi_encode(union acpi_object *obj, u8 *buf,
+				size_t space, int depth)
+{
+	struct acpi_buffer name = {ACPI_ALLOCATE_BUFFER, NULL};
+	struct fwdt_acpi_object hdr = {.type = obj->type};
+	const void *data = NULL;
+	ssize_t size, ret;
+	u32 i;
+
+	if (depth > FWDT_ACPI_DEPTH_MAX)
+		return -E2BIG;
+
+	switch (obj->type) {
+	case ACPI_TYPE_INTEGER:
+		hdr.length = sizeof(u64);
+		data = &obj->integer.value;
+		break;
+	case ACPI_TYPE_STRING:
+		hdr.length = obj->string.length;
+		data = obj->string.pointer;
+		break;
+	case ACPI_TYPE_BUFFER:
+		hdr.length = obj->buffer.length;
+		data = obj->buffer.pointer;
+		break;
+	case ACPI_TYPE_PACKAGE:
+		hdr.length = obj->package.count;
+		if (buf) {
+			if (space < sizeof(hdr))
+				return -ENOSPC;
+			memcpy(buf, &hdr, sizeof(hdr));
+		}
+
+		size = sizeof(hdr);
+		for (i = 0; i < obj->package.count; i++) {
+			ret = fwdt_acpi_encode(&obj->package.elements[i],
+					       buf ? buf + size : NULL,
+					       buf ? space - size : 0,
+					       depth + 1);
+			if (ret < 0)
+				return ret;
+			size += ret;
+		}
+		return size;
+	case ACPI_TYPE_LOCAL_REFERENCE:
+		if (ACPI_FAILURE(acpi_get_name(obj->reference.handle,
+					       ACPI_FULL_PATHNAME, &name)))
+			return -ENOENT;
+		hdr.length = strlen(name.pointer);
+		data = name.pointer;
+		break;
+	default:
+		break;
+	}
+
+	size = sizeof(hdr) + hdr.length;
+	if (buf) {
+		if (space < size) {
+			size = -ENOSPC;
+		} else {
+			memcpy(buf, &hdr, sizeof(hdr));
+			if (data)
+				memcpy(buf + sizeof(hdr), data, hdr.length);
+		}
+	}
+	ACPI_FREE(name.pointer);
+
+	return size;
+}
+
 int handle_acpi_aml_cmd(fwdt_generic __user *fg)
 {
-	int ret = 0;
+	struct acpi_buffer buffer = {ACPI_ALLOCATE_BUFFER, NULL};
+	union acpi_object args[ACPI_METHOD_NUM_ARGS];
+	struct acpi_object_list arg_list;
 	struct fwdt_acpi_data fd;
+	const u8 *pos, *end;
+	acpi_handle handle;
+	acpi_status status;
+	u8 *abuf = NULL;
+	ssize_t size;
+	u8 *rbuf;
+	int ret = 0;
+	u32 i, j;
 
 	if (unlikely(copy_from_user(&fd, fg, sizeof(struct fwdt_acpi_data))))
 		return -EFAULT;
 
-	switch (fg->parameters.func) {
-	case GET_DATA_DWORD:
-		// TODO evaluate acpi object
-		break;
-	default:
+	if (fd.parameters.func != EVALUATE_ACPI_OBJECT)
+		return -EINVAL;
+
+	if (fd.num_args > ACPI_METHOD_NUM_ARGS ||
+	    fd.args_size > FWDT_ACPI_ARGS_MAX)
+		return -EINVAL;
+
+	fd.acpi_path[sizeof(fd.acpi_path) - 1] = 0;
+
+	if (fd.args_size) {
+		abuf = memdup_user(u64_to_user_ptr(fd.args), fd.args_size);
+		if (IS_ERR(abuf))
+			return PTR_ERR(abuf);
+	}
+
+	pos = abuf;
+	end = abuf + fd.args_size;
+	for (i = 0; i < fd.num_args; i++) {
+		ret = fwdt_acpi_decode(&pos, end, &args[i], 0);
+		if (ret)
+			goto out;
+	}
+
+	if (pos != end) {
 		ret = -EINVAL;
-		goto err;
-		break;
+		goto out;
 	}
 
-	if (unlikely(copy_to_user(fg, &fd, sizeof(struct fwdt_acpi_data))))
-		return -EFAULT;
+	arg_list.count = fd.num_args;
+	arg_list.pointer = args;
 
-err:
+	status = acpi_get_handle(NULL, fd.acpi_path, &handle);
+	if (ACPI_FAILURE(status)) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	status = acpi_evaluate_object(handle, NULL, &arg_list, &buffer);
+	if (ACPI_FAILURE(status)) {
+		pr_info("Failed to execute %s: %s\n", fd.acpi_path,
+			acpi_format_exception(status));
+		ret = -EIO;
+		goto out;
+	}
+
+	size = 0;
+	if (buffer.pointer)
+		size = fwdt_acpi_encode(buffer.pointer, NULL, 0, 0);
+	if (size < 0) {
+		ret = size;
+		goto out_result;
+	} else if (size > fd.result_size) {
+		ret = -ENOSPC;
+	} else if (size) {
+		rbuf = kvmalloc(size, GFP_KERNEL);
+		if (!rbuf) {
+			ret = -ENOMEM;
+			goto out_result;
+		}
+
+		/* the namespace may have changed since the size was taken */
+		ret = fwdt_acpi_encode(buffer.pointer, rbuf, size, 0);
+		if (ret == size) {
+			ret = 0;
+			if (copy_to_user(u64_to_user_ptr(fd.result), rbuf,
+					 size))
+				ret = -EFAULT;
+		} else if (ret >= 0) {
+			ret = -EAGAIN;
+		}
+		kvfree(rbuf);
+		if (ret)
+			goto out_result;
+	}
+
+	fd.result_size = size;
+	if (unlikely(copy_to_user(fg, &fd, sizeof(struct fwdt_acpi_data))))
+		ret = -EFAULT;
+
+out_result:
+	ACPI_FREE(buffer.pointer);
+out:
+	for (j = 0; j < i; j++)
+		fwdt_acpi_free_object(&args[j]);
+	kfree(abuf);
 	return ret;
 }
 
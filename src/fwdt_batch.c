@@ -0,0 +1,112 @@
+/*
+ * FWDT batch driver
+ *
+ * Copyright(C) 2016-2021 Canonical Ltd.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#define pr_fmt(fmt) "fwdt: " fmt
+
+#include "fwdt_lib.h"
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+static int fwdt_batch_run_op(struct fwdt_batch_op *op)
+{
+	u32 data = op->data;
+	u8 byte = op->data;
+	int ret;
+
+	switch (op->type) {
+#ifdef CONFIG_X86
+	case FWDT_BATCH_IO:
+		if (op->address > 0xFFFF)
+			return -EINVAL;
+		ret = fwdt_io_access(op->func, op->address, &data);
+		break;
+	case FWDT_BATCH_CMOS:
+		if (op->address > 0xFF)
+			return -EINVAL;
+		ret = fwdt_cmos_access(op->func, op->address, &byte);
+		data = byte;
+		break;
+#endif
+	case FWDT_BATCH_MEMORY:
+		ret = fwdt_mem_access(op->func, op->address, &data);
+		break;
+#ifdef CONFIG_ACPI
+	case FWDT_BATCH_EC:
+		if (op->address > 0xFF)
+			return -EINVAL;
+		ret = fwdt_ec_access(op->func, op->address, &byte);
+		data = byte;
+		break;
+#endif
+#ifdef CONFIG_PCI
+	case FWDT_BATCH_PCI:
+		ret = fwdt_pci_access(op->func, op->address, &data);
+		break;
+#endif
+	default:
+		ret = -EOPNOTSUPP;
+		break;
+	}
+
+	if (!ret)
+		op->data = data;
+
+	return ret;
+}
+
+int handle_batch_cmd(fwdt_generic __user *fg)
+{
+	struct fwdt_batch_data fbd;
+	struct fwdt_batch_op *ops;
+	void __user *uops;
+	size_t size;
+	u32 i;
+	int ret = 0;
+
+	if (unlikely(copy_from_user(&fbd, fg, sizeof(struct fwdt_batch_data))))
+		return -EFAULT;
+
+	if (fbd.count == 0 || fbd.count > FWDT_BATCH_MAX_OPS)
+		return -EINVAL;
+
+	uops = u64_to_user_ptr(fbd.ops);
+	size = fbd.count * sizeof(struct fwdt_batch_op);
+	ops = vmemdup_user(uops, size);
+	if (IS_ERR(ops))
+		return PTR_ERR(ops);
+
+	for (i = 0; i < fbd.count; i++) {
+		ops[i].status = fwdt_batch_run_op(&ops[i]);
+		if (ops[i].status && (fbd.flags & FWDT_BATCH_STOP_ON_ERROR)) {
+			i++;
+			break;
+		}
+	}
+
+	/* count reports how many ops were executed */
+	fbd.count = i;
+
+	if (unlikely(copy_to_user(uops, ops, i * sizeof(struct fwdt_batch_op))))
+		ret = -EFAULT;
+	else if (unlikely(copy_to_user(fg, &fbd,
+				       sizeof(struct fwdt_batch_data))))
+		ret = -EFAULT;
+
+	kvfree(ops);
+	return ret;
+}
@@ -18,57 +18,185 @@
 
 #include "fwdt_lib.h"
 #include <asm/time.h>
+#include <linux/delay.h>
+#include <linux/mc146818rtc.h>
 #include <linux/module.h>
 #include <linux/semaphore.h>
 #include <linux/uaccess.h>
 
 #ifdef CONFIG_X86
 
+/* Offsets from 0x80 live in the extended bank behind RTC_PORT(2)/(3) */
+static u8 cmos_read_byte(u8 offset)
+{
+	if (offset < 0x80)
+		return CMOS_READ(offset);
+
+	outb(offset, RTC_PORT(2));
+	return inb(RTC_PORT(3));
+}
+
+static void cmos_write_byte(u8 data, u8 offset)
+{
+	if (offset < 0x80) {
+		CMOS_WRITE(data, offset);
+		return;
+	}
+
+	outb(offset, RTC_PORT(2));
+	outb(data, RTC_PORT(3));
+}
+
+/*
+ * Take rtc_lock once the update-in-progress flag reads clear. No update
+ * starts for 244us after that, enough to transfer the clock registers
+ * at 0x00-0x09 which come first in a block.
+ */
+static int cmos_lock_no_uip(unsigned long *flags)
+{
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		spin_lock_irqsave(&rtc_lock, *flags);
+		if (!(CMOS_READ(RTC_FREQ_SELECT) & RTC_UIP))
+			return 0;
+		spin_unlock_irqrestore(&rtc_lock, *flags);
+		udelay(10);
+	}
+
+	return -EBUSY;
+}
+
 static int cmos_offset;
 ssize_t cmos_read_data(struct device *dev, struct device_attribute *attr,
 		       char *buf)
 {
-	if (cmos_offset > 0xFF)
+	unsigned long flags;
+	u8 data;
+
+	spin_lock_irqsave(&rtc_lock, flags);
+	data = cmos_read_byte(cmos_offset);
+	spin_unlock_irqrestore(&rtc_lock, flags);
+
+	return sprintf(buf, "0x%02x\n", data);
+}
+
+ssize_t cmos_write_data(struct device *dev, struct device_attribute *attr,
+			const char *buf, size_t count)
+{
+	unsigned long flags;
+	u8 data;
+
+	if (kstrtou8(buf, 16, &data))
 		return -EINVAL;
 
-	return sprintf(buf, "0x%02x\n", CMOS_READ(cmos_offset));
+	spin_lock_irqsave(&rtc_lock, flags);
+	cmos_write_byte(data, cmos_offset);
+	spin_unlock_irqrestore(&rtc_lock, flags);
+
+	return count;
 }
 
 ssize_t cmos_write_addr(struct device *dev, struct device_attribute *attr,
 			const char *buf, size_t count)
 {
-	if (kstrtoint(buf, 16, &cmos_offset))
+	unsigned long flags;
+	int offset;
+
+	if (kstrtoint(buf, 16, &offset))
 		return -EINVAL;
 
-	if (cmos_offset > 0xFF)
+	if (offset < 0 || offset > 0xFF)
 		return -EINVAL;
 
+	spin_lock_irqsave(&rtc_lock, flags);
+	cmos_offset = offset;
+	spin_unlock_irqrestore(&rtc_lock, flags);
+
 	return count;
 }
 
-int handle_hardware_cmos_cmd(fwdt_generic __user *fg)
+int fwdt_cmos_access(u16 func, u8 addr, u8 *data)
 {
+	unsigned long flags;
 	int ret = 0;
-	struct fwdt_cmos_data fcd;
 
-	if (unlikely(copy_from_user(&fcd, fg, sizeof(struct fwdt_cmos_data))))
-		return -EFAULT;
-
-	switch (fg->parameters.func) {
+	spin_lock_irqsave(&rtc_lock, flags);
+	switch (func) {
 	case GET_DATA_BYTE:
-		fcd.cmos_data = CMOS_READ(fcd.cmos_address);
+		*data = cmos_read_byte(addr);
+		break;
+	case SET_DATA_BYTE:
+		cmos_write_byte(*data, addr);
 		break;
 	default:
 		ret = -EINVAL;
-		goto err;
 		break;
 	}
+	spin_unlock_irqrestore(&rtc_lock, flags);
+
+	return ret;
+}
+
+int handle_hardware_cmos_cmd(fwdt_generic __user *fg)
+{
+	int ret;
+	struct fwdt_cmos_data fcd;
+
+	if (unlikely(copy_from_user(&fcd, fg, sizeof(struct fwdt_cmos_data))))
+		return -EFAULT;
+
+	ret = fwdt_cmos_access(fcd.parameters.func, fcd.cmos_address,
+			       &fcd.cmos_data);
+	if (ret)
+		return ret;
 
 	if (unlikely(copy_to_user(fg, &fcd, sizeof(struct fwdt_cmos_data))))
 		return -EFAULT;
 
-err:
-	return ret;
+	return 0;
+}
+
+/* The whole range is transferred under a single rtc_lock hold */
+int handle_hardware_cmos_block_cmd(fwdt_generic __user *fg)
+{
+	struct fwdt_cmos_block fcb;
+	unsigned long flags;
+	u16 i;
+
+	if (unlikely(copy_from_user(&fcb, fg, sizeof(struct fwdt_cmos_block))))
+		return -EFAULT;
+
+	if (fcb.length == 0 || fcb.cmos_address + fcb.length > FWDT_CMOS_SIZE)
+		return -EINVAL;
+
+	if (fcb.parameters.func != GET_DATA_BLOCK &&
+	    fcb.parameters.func != SET_DATA_BLOCK)
+		return -EINVAL;
+
+	if (fcb.cmos_address < RTC_REG_A) {
+		if (cmos_lock_no_uip(&flags))
+			return -EBUSY;
+	} else {
+		spin_lock_irqsave(&rtc_lock, flags);
+	}
+
+	if (fcb.parameters.func == GET_DATA_BLOCK) {
+		for (i = fcb.cmos_address; i < fcb.cmos_address + fcb.length; i++)
+			fcb.data[i] = cmos_read_byte(i);
+	} else {
+		for (i = fcb.cmos_address; i < fcb.cmos_address + fcb.length; i++)
+			cmos_write_byte(fcb.data[i], i);
+	}
+	spin_unlock_irqrestore(&rtc_lock, flags);
+
+	if (fcb.parameters.func == SET_DATA_BLOCK)
+		return 0;
+
+	if (unlikely(copy_to_user(fg, &fcb, sizeof(struct fwdt_cmos_block))))
+		return -EFAULT;
+
+	return 0;
 }
 
 #endif
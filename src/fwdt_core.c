@@ -19,6 +19,7 @@
 #include <linux/acpi.h>
 #include <acpi/acpi_bus.h>
 #include <acpi/video.h>
+#include <linux/debugfs.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/miscdevice.h>
@@ -26,6 +27,7 @@
 #include <linux/platform_device.h>
 #include <linux/proc_fs.h>
 #include <linux/semaphore.h>
+#include <linux/slab.h>
 #include <linux/uaccess.h>
 
 #include "fwdt_lib.h"
@@ -47,6 +49,7 @@ static struct platform_driver fwdt_driver = {
 };
 
 static struct platform_device *fwdt_platform_dev;
+struct dentry *fwdt_debugfs_dir;
 
 #ifdef CONFIG_ACPI
 
@@ -85,6 +88,8 @@ static DEVICE_ATTR(ec_qmethod, S_IWUSR, NULL, ec_exec_qmethod);
 static DEVICE_ATTR(mem_address, S_IRUGO | S_IWUSR, mem_read_address,
 		   mem_write_address);
 static DEVICE_ATTR(mem_data, S_IRUGO | S_IWUSR, mem_read_data, mem_write_data);
+static BIN_ATTR(mem_window, S_IRUSR | S_IWUSR, mem_window_read,
+		mem_window_write, 0);
 
 #ifdef CONFIG_X86
 
@@ -96,6 +101,8 @@ static DEVICE_ATTR(iob_data, S_IRUGO | S_IWUSR, iob_read_data, iob_write_data);
 
 /* CMOS */
 static DEVICE_ATTR(cmos, S_IRUGO | S_IWUSR, cmos_read_data, cmos_write_addr);
+static DEVICE_ATTR(cmos_data, S_IRUGO | S_IWUSR, cmos_read_data,
+		   cmos_write_data);
 
 /* MSR */
 static DEVICE_ATTR(msr, S_IRUGO | S_IWUSR, msr_read_data, msr_set_register);
@@ -104,7 +111,6 @@ static DEVICE_ATTR(msr, S_IRUGO | S_IWUSR, msr_read_data, msr_set_register);
 
 #ifdef CONFIG_PCI
 /* PCI */
-extern Pci_dev pci_dev;
 static DEVICE_ATTR(pci_data, S_IRUGO | S_IWUSR, pci_read_data, pci_write_data);
 static DEVICE_ATTR(pci_reg, S_IRUGO | S_IWUSR, pci_read_offset,
 		   pci_write_offset);
@@ -146,9 +152,14 @@ static struct attribute *fwdt_memory_sysfs_entries[] = {
     &dev_attr_mem_address.attr, &dev_attr_mem_data.attr, NULL,
 };
 
+static struct bin_attribute *fwdt_memory_sysfs_bin_entries[] = {
+    &bin_attr_mem_window, NULL,
+};
+
 static struct attribute_group memory_attr_group = {
     .name = NULL, /* put in device directory */
     .attrs = fwdt_memory_sysfs_entries,
+    .bin_attrs = fwdt_memory_sysfs_bin_entries,
 };
 
 #ifdef CONFIG_X86
@@ -182,6 +193,7 @@ static struct attribute_group pci_attr_group = {
 static long fwdt_runtime_ioctl(struct file *file, unsigned int cmd,
 			       unsigned long arg)
 {
+	struct fwdt_context *ctx = file->private_data;
 	int err;
 
 	switch (cmd) {
@@ -192,6 +204,12 @@ static long fwdt_runtime_ioctl(struct file *file, unsigned int cmd,
 	case FWDT_ACPI_EC_CMD:
 		err = handle_acpi_ec_cmd((fwdt_generic __user *)arg);
 		break;
+	case FWDT_ACPI_EC_BLOCK_CMD:
+		err = handle_acpi_ec_block_cmd((fwdt_generic __user *)arg);
+		break;
+	case FWDT_ACPI_EC_UPDATE_CMD:
+		err = handle_acpi_ec_update_cmd((fwdt_generic __user *)arg);
+		break;
 	case FWDT_ACPI_AML_CMD:
 		err = handle_acpi_aml_cmd((fwdt_generic __user *)arg);
 		break;
@@ -200,13 +218,66 @@ static long fwdt_runtime_ioctl(struct file *file, unsigned int cmd,
 	case FWDT_HW_ACCESS_IO_CMD:
 		err = handle_hardware_io_cmd((fwdt_generic __user *)arg);
 		break;
+	case FWDT_HW_ACCESS_IO_DWORD_CMD:
+		err = handle_hardware_io_dword_cmd((fwdt_generic __user *)arg);
+		break;
+	case FWDT_HW_ACCESS_IO_BLOCK_CMD:
+		err = handle_hardware_io_block_cmd((fwdt_generic __user *)arg);
+		break;
+	case FWDT_HW_ACCESS_IO_INDEX_CMD:
+		err = handle_hardware_io_index_cmd((fwdt_generic __user *)arg);
+		break;
 	case FWDT_HW_ACCESS_CMOS_CMD:
 		err = handle_hardware_cmos_cmd((fwdt_generic __user *)arg);
 		break;
+	case FWDT_HW_ACCESS_CMOS_BLOCK_CMD:
+		err = handle_hardware_cmos_block_cmd(
+		    (fwdt_generic __user *)arg);
+		break;
+	case FWDT_MSR_CMD:
+		err = handle_msr_cmd((fwdt_generic __user *)arg);
+		break;
+	case FWDT_MSR_LIST_CMD:
+		err = handle_msr_list_cmd((fwdt_generic __user *)arg);
+		break;
+	case FWDT_MSR_SAMPLER_CMD:
+		err = handle_msr_sampler_cmd((fwdt_generic __user *)arg);
+		break;
 #endif
 	case FWDT_HW_ACCESS_MEMORY_CMD:
 		err = handle_hardware_memory_cmd((fwdt_generic __user *)arg);
 		break;
+	case FWDT_HW_ACCESS_MEMORY_BLOCK_CMD:
+		err = handle_hardware_memory_block_cmd(
+		    (fwdt_generic __user *)arg);
+		break;
+	case FWDT_MEM_SCAN_CMD:
+		err = handle_memory_scan_cmd((fwdt_generic __user *)arg);
+		break;
+	case FWDT_MEM_SNAPSHOT_CMD:
+		err = handle_memory_snapshot_cmd(ctx,
+						 (fwdt_generic __user *)arg);
+		break;
+	case FWDT_MEM_MAP_CMD:
+		err = handle_memory_map_cmd(ctx, (fwdt_generic __user *)arg);
+		break;
+#ifdef CONFIG_PCI
+	case FWDT_PCI_CONFIG_CMD:
+		err = handle_pci_config_cmd((fwdt_generic __user *)arg);
+		break;
+	case FWDT_PCI_INVENTORY_CMD:
+		err = handle_pci_inventory_cmd((fwdt_generic __user *)arg);
+		break;
+	case FWDT_PCI_CAP_CMD:
+		err = handle_pci_cap_cmd((fwdt_generic __user *)arg);
+		break;
+	case FWDT_PCI_BAR_CMD:
+		err = handle_pci_bar_cmd(ctx, (fwdt_generic __user *)arg);
+		break;
+#endif
+	case FWDT_BATCH_CMD:
+		err = handle_batch_cmd((fwdt_generic __user *)arg);
+		break;
 	default:
 		err = -EINVAL;
 		break;
@@ -215,24 +286,45 @@ static long fwdt_runtime_ioctl(struct file *file, unsigned int cmd,
 	return err;
 }
 
-static struct semaphore fwdt_lock;
 static int fwdt_runtime_open(struct inode *inode, struct file *file)
 {
-	if (down_trylock(&fwdt_lock))
-		return -EBUSY;
+	struct fwdt_context *ctx;
+
+	ctx = kzalloc(sizeof(struct fwdt_context), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	mutex_init(&ctx->lock);
+	idr_init(&ctx->snapshots);
+	INIT_LIST_HEAD(&ctx->bar_maps);
+	file->private_data = ctx;
 
 	return 0;
 }
 
+static int fwdt_runtime_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	return fwdt_mem_mmap(file->private_data, vma);
+}
+
 static int fwdt_runtime_close(struct inode *inode, struct file *file)
 {
-	up(&fwdt_lock);
+	struct fwdt_context *ctx = file->private_data;
+
+	fwdt_mem_release(ctx);
+#ifdef CONFIG_PCI
+	fwdt_pci_release(ctx);
+#endif
+	idr_destroy(&ctx->snapshots);
+	mutex_destroy(&ctx->lock);
+	kfree(ctx);
 	return 0;
 }
 
 static const struct file_operations fwdt_runtime_fops = {
     .owner = THIS_MODULE,
     .unlocked_ioctl = fwdt_runtime_ioctl,
+    .mmap = fwdt_runtime_mmap,
     .open = fwdt_runtime_open,
     .release = fwdt_runtime_close,
     .llseek = no_llseek,
@@ -260,6 +352,7 @@ static void cleanup_sysfs(struct platform_device *device)
 #ifdef CONFIG_X86
 	sysfs_remove_group(&device->dev.kobj, &io_attr_group);
 	device_remove_file(&device->dev, &dev_attr_cmos);
+	device_remove_file(&device->dev, &dev_attr_cmos_data);
 	device_remove_file(&device->dev, &dev_attr_msr);
 #endif
 
@@ -299,6 +392,9 @@ static int fwdt_setup(struct platform_device *device)
 	if (err)
 		goto add_sysfs_error;
 	err = device_create_file(&device->dev, &dev_attr_cmos);
+	if (err)
+		goto add_sysfs_error;
+	err = device_create_file(&device->dev, &dev_attr_cmos_data);
 	if (err)
 		goto add_sysfs_error;
 	err = device_create_file(&device->dev, &dev_attr_msr);
@@ -342,21 +438,37 @@ static int __init fwdt_init(void)
 	if (err)
 		goto err_device_add;
 
+	fwdt_debugfs_dir = debugfs_create_dir("fwdt", NULL);
+	fwdt_mem_init();
+#ifdef CONFIG_X86
+	fwdt_msr_sampler_init();
+#endif
+#ifdef CONFIG_ACPI
+	fwdt_ec_event_init();
+#endif
+
 	err = misc_register(&fwdt_runtime_dev);
 	if (err) {
 		printk(KERN_ERR "fwdt: can't misc_register on minor=%d\n",
 		       MISC_DYNAMIC_MINOR);
-		goto err_driver_reg;
+		goto err_misc_reg;
 	}
 
-	sema_init(&fwdt_lock, 1);
-
 #ifdef CONFIG_PCI
-	memset(&pci_dev, 0xFF, sizeof(pci_dev));
+	fwdt_pci_init();
 #endif
 
 	return 0;
 
+err_misc_reg:
+#ifdef CONFIG_ACPI
+	fwdt_ec_event_exit();
+#endif
+#ifdef CONFIG_X86
+	fwdt_msr_sampler_exit();
+#endif
+	debugfs_remove_recursive(fwdt_debugfs_dir);
+	platform_device_del(fwdt_platform_dev);
 err_device_add:
 	platform_device_put(fwdt_platform_dev);
 err_device_alloc:
@@ -375,6 +487,18 @@ static void __exit fwdt_exit(void)
 	}
 
 	misc_deregister(&fwdt_runtime_dev);
+#ifdef CONFIG_ACPI
+	fwdt_ec_event_exit();
+#endif
+#ifdef CONFIG_X86
+	fwdt_msr_sampler_exit();
+#endif
+#ifdef CONFIG_PCI
+	fwdt_pci_exit();
+#endif
+
+	debugfs_remove_recursive(fwdt_debugfs_dir);
+	fwdt_mem_exit();
 }
 
 module_init(fwdt_init);
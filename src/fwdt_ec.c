@@ -19,12 +19,23 @@
 #include "fwdt_lib.h"
 #include <linux/acpi.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/semaphore.h>
+#include <linux/slab.h>
 #include <linux/uaccess.h>
 
 #ifdef CONFIG_ACPI
 
+/* EC commands not exported by the ACPI EC driver */
+#define FWDT_EC_BURST_ENABLE 0x82
+#define FWDT_EC_BURST_DISABLE 0x83
+#define FWDT_EC_BURST_ACK 0x90
+
+/* how long to wait for the ACPI global lock, in milliseconds */
+#define FWDT_EC_GLK_TIMEOUT 1000
+
 acpi_handle ec_device = NULL;
+static DEFINE_MUTEX(fwdt_ec_lock);
 static int ec_offset;
 ssize_t ec_read_data(struct device *dev, struct device_attribute *attr,
 		     char *buf)
@@ -32,7 +43,9 @@ ssize_t ec_read_data(struct device *dev, struct device_attribute *attr,
 	int ret;
 	u8 data;
 
+	mutex_lock(&fwdt_ec_lock);
 	ret = ec_read(ec_offset, &data);
+	mutex_unlock(&fwdt_ec_lock);
 	if (ret)
 		return -EINVAL;
 
@@ -46,7 +59,9 @@ ssize_t ec_write_data(struct device *dev, struct device_attribute *attr,
 	u8 data;
 
 	data = simple_strtoul(buf, NULL, 16);
+	mutex_lock(&fwdt_ec_lock);
 	ret = ec_write(ec_offset, data);
+	mutex_unlock(&fwdt_ec_lock);
 	if (ret)
 		return -EINVAL;
 
@@ -62,7 +77,9 @@ ssize_t ec_read_addr(struct device *dev, struct device_attribute *attr,
 ssize_t ec_write_addr(struct device *dev, struct device_attribute *attr,
 		      const char *buf, size_t count)
 {
+	mutex_lock(&fwdt_ec_lock);
 	ec_offset = simple_strtoul(buf, NULL, 16);
+	mutex_unlock(&fwdt_ec_lock);
 	return count;
 }
 
@@ -85,6 +102,30 @@ ssize_t ec_exec_qmethod(struct device *dev, struct device_attribute *attr,
 	return count;
 }
 
+int fwdt_ec_access(u16 func, u8 addr, u8 *data)
+{
+	int ret;
+
+	if (!ec_device)
+		return -ENODEV;
+
+	mutex_lock(&fwdt_ec_lock);
+	switch (func) {
+	case GET_DATA_BYTE:
+		ret = ec_read(addr, data);
+		break;
+	case SET_DATA_BYTE:
+		ret = ec_write(addr, *data);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	mutex_unlock(&fwdt_ec_lock);
+
+	return ret;
+}
+
 int handle_acpi_ec_cmd(fwdt_generic __user *fg)
 {
 	int err;
@@ -98,13 +139,13 @@ int handle_acpi_ec_cmd(fwdt_generic __user *fg)
 
 	switch (fg->parameters.func) {
 	case GET_EC_REGISTER:
-		err = ec_read(ecd.address, &ecd.data);
+		err = fwdt_ec_access(GET_DATA_BYTE, ecd.address, &ecd.data);
 		if (unlikely(
 			copy_to_user(fec, &ecd, sizeof(struct fwdt_ec_data))))
 			return -EFAULT;
 		break;
 	case SET_EC_REGISTER:
-		err = ec_write(ecd.address, ecd.data);
+		err = fwdt_ec_access(SET_DATA_BYTE, ecd.address, &ecd.data);
 		break;
 	case CALL_EC_QMETHOD:
 		sprintf(q_num, "_Q%02X", ecd.q_method);
@@ -130,4 +171,142 @@ int handle_acpi_ec_cmd(fwdt_generic __user *fg)
 	return err;
 }
 
+/*
+ * Put the EC in burst mode so it services the following transactions
+ * without releasing the host interface between them. Callers hold
+ * fwdt_ec_lock; a refused burst only costs speed, not correctness.
+ */
+static bool fwdt_ec_burst_enable(void)
+{
+	u8 ack = 0;
+
+	if (ec_transaction(FWDT_EC_BURST_ENABLE, NULL, 0, &ack, 1))
+		return false;
+
+	return ack == FWDT_EC_BURST_ACK;
+}
+
+static void fwdt_ec_burst_disable(void)
+{
+	ec_transaction(FWDT_EC_BURST_DISABLE, NULL, 0, NULL, 0);
+}
+
+int handle_acpi_ec_block_cmd(fwdt_generic __user *fg)
+{
+	int err = 0;
+	struct fwdt_ec_block feb;
+	bool burst;
+	u16 i, end;
+
+	if (unlikely(copy_from_user(&feb, fg, sizeof(struct fwdt_ec_block))))
+		return -EFAULT;
+
+	if (ec_device == NULL)
+		return -ENODEV;
+
+	end = feb.address + feb.length;
+	if (feb.length == 0 || end > FWDT_EC_SIZE)
+		return -EINVAL;
+
+	if (feb.parameters.func != GET_EC_BLOCK &&
+	    feb.parameters.func != SET_EC_BLOCK)
+		return -EINVAL;
+
+	mutex_lock(&fwdt_ec_lock);
+	burst = fwdt_ec_burst_enable();
+	for (i = feb.address; i < end && !err; i++) {
+		if (feb.parameters.func == GET_EC_BLOCK)
+			err = ec_read(i, &feb.data[i]);
+		else
+			err = ec_write(i, feb.data[i]);
+	}
+	if (burst)
+		fwdt_ec_burst_disable();
+	mutex_unlock(&fwdt_ec_lock);
+
+	if (err)
+		return err;
+
+	if (feb.parameters.func == GET_EC_BLOCK &&
+	    unlikely(copy_to_user(fg, &feb, sizeof(struct fwdt_ec_block))))
+		return -EFAULT;
+
+	return 0;
+}
+
+/*
+ * Apply read-modify-write updates with fwdt_ec_lock held once, which
+ * serializes them against other fwdt EC accesses. When the EC declares
+ * _GLK, firmware arbitrates EC access with the ACPI global lock, so it is
+ * also held across each read and write and AML or SMM cannot change the
+ * byte in between. Without _GLK nothing excludes the firmware; burst mode,
+ * when the EC grants it, merely shortens that window.
+ */
+int handle_acpi_ec_update_cmd(fwdt_generic __user *fg)
+{
+	int err = 0;
+	struct fwdt_ec_update feu;
+	struct fwdt_ec_mask_op *ops;
+	unsigned long long glk;
+	void __user *uops;
+	u32 glk_handle;
+	bool burst;
+	u32 i;
+
+	if (unlikely(copy_from_user(&feu, fg, sizeof(struct fwdt_ec_update))))
+		return -EFAULT;
+
+	if (ec_device == NULL)
+		return -ENODEV;
+
+	if (feu.parameters.func != UPDATE_EC_REGISTER || feu.count == 0 ||
+	    feu.count > FWDT_EC_UPDATE_MAX)
+		return -EINVAL;
+
+	uops = u64_to_user_ptr(feu.updates);
+	ops = memdup_user(uops, feu.count * sizeof(struct fwdt_ec_mask_op));
+	if (IS_ERR(ops))
+		return PTR_ERR(ops);
+
+	if (ACPI_FAILURE(acpi_evaluate_integer(ec_device, "_GLK", NULL, &glk)))
+		glk = 0;
+
+	mutex_lock(&fwdt_ec_lock);
+	burst = fwdt_ec_burst_enable();
+	for (i = 0; i < feu.count; i++) {
+		if (glk &&
+		    ACPI_FAILURE(acpi_acquire_global_lock(FWDT_EC_GLK_TIMEOUT,
+							  &glk_handle))) {
+			err = -EBUSY;
+			break;
+		}
+
+		err = ec_read(ops[i].address, &ops[i].old_data);
+		if (!err) {
+			ops[i].new_data = (ops[i].old_data & ops[i].and_mask) |
+					  ops[i].or_mask;
+			if (ops[i].new_data != ops[i].old_data)
+				err = ec_write(ops[i].address,
+					       ops[i].new_data);
+		}
+
+		if (glk)
+			acpi_release_global_lock(glk_handle);
+		if (err)
+			break;
+	}
+	if (burst)
+		fwdt_ec_burst_disable();
+	mutex_unlock(&fwdt_ec_lock);
+
+	feu.count = i;
+	if (unlikely(copy_to_user(uops, ops,
+				  i * sizeof(struct fwdt_ec_mask_op))) ||
+	    unlikely(copy_to_user(fg, &feu, sizeof(struct fwdt_ec_update))))
+		err = -EFAULT;
+
+	kfree(ops);
+	return err;
+}
+
 #endif
@@ -0,0 +1,305 @@
+/*
+ * FWDT EC event capture driver
+ *
+ * Copyright(C) 2016-2021 Canonical Ltd.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#define pr_fmt(fmt) "fwdt: " fmt
+
+#include "fwdt_lib.h"
+#include <linux/acpi.h>
+#include <linux/atomic.h>
+#include <linux/bsearch.h>
+#include <linux/kprobes.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#ifdef CONFIG_ACPI
+
+/*
+ * The ACPI EC driver runs _Qxx through acpi_evaluate_object() with the
+ * method handle. A kprobe there matches the handle against the _Qxx
+ * methods of ec_device and records the query number with a timestamp.
+ */
+
+#define FWDT_EC_EVENT_RING_SIZE 4096
+
+struct fwdt_ec_qmethod {
+	acpi_handle handle;
+	u8 query;
+};
+
+struct fwdt_ec_event_slot {
+	u64 seq;
+	struct fwdt_ec_event event;
+};
+
+static struct fwdt_ec_qmethod *ec_qmethods;
+static int ec_num_qmethods;
+
+/*
+ * Producers claim slots with an atomic increment, clear seq while they
+ * rewrite the payload and publish it by storing seq = position + 1. The
+ * single reader detects slots that were overwritten before it got to them
+ * from a newer seq, and ones rewritten while it copied them from seq
+ * changing across the copy.
+ */
+static struct fwdt_ec_event_slot *ec_event_ring;
+static atomic64_t ec_event_head;
+static u64 ec_event_tail;
+static DECLARE_WAIT_QUEUE_HEAD(ec_event_wait);
+static DEFINE_MUTEX(fwdt_ec_event_lock);
+static atomic_t ec_event_open = ATOMIC_INIT(0);
+static bool ec_event_registered;
+
+static int fwdt_ec_qmethod_cmp(const void *a, const void *b)
+{
+	const struct fwdt_ec_qmethod *qa = a, *qb = b;
+
+	if (qa->handle == qb->handle)
+		return 0;
+
+	return qa->handle < qb->handle ? -1 : 1;
+}
+
+static int fwdt_ec_event_probe(struct kprobe *p, struct pt_regs *regs)
+{
+	struct fwdt_ec_qmethod key, *qm;
+	struct fwdt_ec_event_slot *slot;
+	u64 pos;
+
+	key.handle = (acpi_handle)regs_get_kernel_argument(regs, 0);
+	qm = bsearch(&key, ec_qmethods, ec_num_qmethods,
+		     sizeof(struct fwdt_ec_qmethod), fwdt_ec_qmethod_cmp);
+	if (!qm)
+		return 0;
+
+	pos = atomic64_inc_return(&ec_event_head) - 1;
+	slot = &ec_event_ring[pos & (FWDT_EC_EVENT_RING_SIZE - 1)];
+
+	/* invalidate the slot so a reader copying the old event drops it */
+	WRITE_ONCE(slot->seq, 0);
+	smp_wmb();
+	slot->event.timestamp = ktime_get_ns();
+	slot->event.query = qm->query;
+	smp_store_release(&slot->seq, pos + 1);
+
+	wake_up_interruptible(&ec_event_wait);
+
+	return 0;
+}
+
+static struct kprobe ec_event_kprobe = {
+	.symbol_name = "acpi_evaluate_object",
+	.pre_handler = fwdt_ec_event_probe,
+};
+
+static int fwdt_ec_find_qmethods(void)
+{
+	acpi_handle handle;
+	char q_num[5];
+	int i;
+
+	ec_qmethods = kcalloc(256, sizeof(struct fwdt_ec_qmethod), GFP_KERNEL);
+	if (!ec_qmethods)
+		return -ENOMEM;
+
+	ec_num_qmethods = 0;
+	for (i = 0; i < 256; i++) {
+		sprintf(q_num, "_Q%02X", i);
+		if (ACPI_FAILURE(acpi_get_handle(ec_device, q_num, &handle)))
+			continue;
+
+		ec_qmethods[ec_num_qmethods].handle = handle;
+		ec_qmethods[ec_num_qmethods].query = i;
+		ec_num_qmethods++;
+	}
+
+	sort(ec_qmethods, ec_num_qmethods, sizeof(struct fwdt_ec_qmethod),
+	     fwdt_ec_qmethod_cmp, NULL);
+
+	return 0;
+}
+
+static int fwdt_ec_event_open(struct inode *inode, struct file *file)
+{
+	int err;
+
+	if (atomic_cmpxchg(&ec_event_open, 0, 1))
+		return -EBUSY;
+
+	ec_event_ring = vzalloc(FWDT_EC_EVENT_RING_SIZE *
+				sizeof(struct fwdt_ec_event_slot));
+	if (!ec_event_ring) {
+		err = -ENOMEM;
+		goto err_ring;
+	}
+
+	err = fwdt_ec_find_qmethods();
+	if (err)
+		goto err_qmethods;
+
+	atomic64_set(&ec_event_head, 0);
+	ec_event_tail = 0;
+
+	err = register_kprobe(&ec_event_kprobe);
+	if (err) {
+		pr_info("Failed to hook EC query methods: %d\n", err);
+		goto err_kprobe;
+	}
+
+	return 0;
+
+err_kprobe:
+	kfree(ec_qmethods);
+err_qmethods:
+	vfree(ec_event_ring);
+err_ring:
+	atomic_set(&ec_event_open, 0);
+	return err;
+}
+
+static int fwdt_ec_event_release(struct inode *inode, struct file *file)
+{
+	unregister_kprobe(&ec_event_kprobe);
+
+	/* kprobe structures are reused on the next open */
+	ec_event_kprobe.addr = NULL;
+	ec_event_kprobe.flags = 0;
+
+	kfree(ec_qmethods);
+	vfree(ec_event_ring);
+	atomic_set(&ec_event_open, 0);
+
+	return 0;
+}
+
+static bool fwdt_ec_event_pending(void)
+{
+	return atomic64_read(&ec_event_head) != ec_event_tail;
+}
+
+static ssize_t fwdt_ec_event_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct fwdt_ec_event_slot *slot;
+	struct fwdt_ec_event event;
+	size_t copied = 0;
+	u64 seq;
+	int err;
+
+	if (count < sizeof(struct fwdt_ec_event))
+		return -EINVAL;
+
+retry:
+	mutex_lock(&fwdt_ec_event_lock);
+	while (!fwdt_ec_event_pending()) {
+		mutex_unlock(&fwdt_ec_event_lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		err = wait_event_interruptible(ec_event_wait,
+					       fwdt_ec_event_pending());
+		if (err)
+			return err;
+		mutex_lock(&fwdt_ec_event_lock);
+	}
+
+	while (copied + sizeof(struct fwdt_ec_event) <= count) {
+		slot = &ec_event_ring[ec_event_tail &
+				      (FWDT_EC_EVENT_RING_SIZE - 1)];
+		seq = smp_load_acquire(&slot->seq);
+		if (seq <= ec_event_tail)
+			break;
+
+		/* the producers lapped us, skip to the oldest kept event */
+		if (seq != ec_event_tail + 1) {
+			ec_event_tail = seq - FWDT_EC_EVENT_RING_SIZE;
+			continue;
+		}
+
+		event = slot->event;
+		smp_rmb();
+		if (READ_ONCE(slot->seq) != seq) {
+			ec_event_tail++;
+			continue;
+		}
+
+		if (copy_to_user(buf + copied, &event,
+				 sizeof(struct fwdt_ec_event))) {
+			mutex_unlock(&fwdt_ec_event_lock);
+			return copied ? copied : -EFAULT;
+		}
+
+		copied += sizeof(struct fwdt_ec_event);
+		ec_event_tail++;
+	}
+	mutex_unlock(&fwdt_ec_event_lock);
+
+	/* a producer claimed a slot but has not published it yet */
+	if (!copied) {
+		cpu_relax();
+		goto retry;
+	}
+
+	return copied;
+}
+
+static __poll_t fwdt_ec_event_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &ec_event_wait, wait);
+
+	return fwdt_ec_event_pending() ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static const struct file_operations fwdt_ec_event_fops = {
+    .owner = THIS_MODULE,
+    .open = fwdt_ec_event_open,
+    .release = fwdt_ec_event_release,
+    .read = fwdt_ec_event_read,
+    .poll = fwdt_ec_event_poll,
+    .llseek = no_llseek,
+};
+
+static struct miscdevice fwdt_ec_event_dev = {MISC_DYNAMIC_MINOR,
+					      "fwdt_ec_events",
+					      &fwdt_ec_event_fops};
+
+void fwdt_ec_event_init(void)
+{
+	if (!ec_device)
+		return;
+
+	if (misc_register(&fwdt_ec_event_dev)) {
+		pr_info("Failed to register EC event device\n");
+		return;
+	}
+
+	ec_event_registered = true;
+}
+
+void fwdt_ec_event_exit(void)
+{
+	if (ec_event_registered)
+		misc_deregister(&fwdt_ec_event_dev);
+}
+
+#endif
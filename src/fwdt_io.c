@@ -18,12 +18,23 @@
 
 #include "fwdt_lib.h"
 #include <linux/kernel.h>
+#include <linux/ioport.h>
+#include <linux/mc146818rtc.h>
+#include <linux/mutex.h>
 #include <linux/platform_device.h>
 #include <linux/semaphore.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 
 #ifdef CONFIG_X86
 
+/*
+ * Serializes port accesses issued through fwdt, so that no fwdt access can
+ * land between the index and the data access of a pair sequence.
+ */
+static DEFINE_MUTEX(fwdt_io_lock);
+
 static u16 io_addr;
 ssize_t io_read_address(struct device *dev, struct device_attribute *attr,
 			char *buf)
@@ -42,7 +53,13 @@ ssize_t io_write_address(struct device *dev, struct device_attribute *attr,
 ssize_t iow_read_data(struct device *dev, struct device_attribute *attr,
 		      char *buf)
 {
-	return sprintf(buf, "0x%04x\n", inw(io_addr));
+	u16 data;
+
+	mutex_lock(&fwdt_io_lock);
+	data = inw(io_addr);
+	mutex_unlock(&fwdt_io_lock);
+
+	return sprintf(buf, "0x%04x\n", data);
 }
 
 ssize_t iow_write_data(struct device *dev, struct device_attribute *attr,
@@ -51,7 +68,9 @@ ssize_t iow_write_data(struct device *dev, struct device_attribute *attr,
 	u16 data;
 
 	data = simple_strtoul(buf, NULL, 16);
+	mutex_lock(&fwdt_io_lock);
 	outw(data, io_addr);
+	mutex_unlock(&fwdt_io_lock);
 
 	return count;
 }
@@ -59,7 +78,13 @@ ssize_t iow_write_data(struct device *dev, struct device_attribute *attr,
 ssize_t iob_read_data(struct device *dev, struct device_attribute *attr,
 		      char *buf)
 {
-	return sprintf(buf, "0x%02x\n", inb(io_addr));
+	u8 data;
+
+	mutex_lock(&fwdt_io_lock);
+	data = inb(io_addr);
+	mutex_unlock(&fwdt_io_lock);
+
+	return sprintf(buf, "0x%02x\n", data);
 }
 
 ssize_t iob_write_data(struct device *dev, struct device_attribute *attr,
@@ -68,42 +93,348 @@ ssize_t iob_write_data(struct device *dev, struct device_attribute *attr,
 	u8 data;
 
 	data = simple_strtoul(buf, NULL, 16);
+	mutex_lock(&fwdt_io_lock);
 	outb(data, io_addr);
+	mutex_unlock(&fwdt_io_lock);
 
 	return count;
 }
 
-int handle_hardware_io_cmd(fwdt_generic __user *fg)
+int fwdt_io_access(u16 func, u16 port, u32 *data)
 {
 	int ret = 0;
+
+	mutex_lock(&fwdt_io_lock);
+	switch (func) {
+	case GET_DATA_BYTE:
+		*data = inb(port);
+		break;
+	case GET_DATA_WORD:
+		*data = inw(port);
+		break;
+	case GET_DATA_DWORD:
+		*data = inl(port);
+		break;
+	case SET_DATA_BYTE:
+		outb(*data, port);
+		break;
+	case SET_DATA_WORD:
+		outw(*data, port);
+		break;
+	case SET_DATA_DWORD:
+		outl(*data, port);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	mutex_unlock(&fwdt_io_lock);
+
+	return ret;
+}
+
+int handle_hardware_io_cmd(fwdt_generic __user *fg)
+{
+	int ret;
+	u32 data;
 	struct fwdt_io_data fid;
 
 	if (unlikely(copy_from_user(&fid, fg, sizeof(struct fwdt_io_data))))
 		return -EFAULT;
 
-	switch (fg->parameters.func) {
+	switch (fid.parameters.func) {
 	case GET_DATA_BYTE:
-		fid.io_byte = inb(fid.io_address);
-		break;
 	case GET_DATA_WORD:
-		fid.io_word = inw(fid.io_address);
+		data = 0;
 		break;
 	case SET_DATA_BYTE:
-		outb(fid.io_byte, fid.io_address);
+		data = fid.io_byte;
 		break;
 	case SET_DATA_WORD:
-		outw(fid.io_word, fid.io_address);
+		data = fid.io_word;
 		break;
 	default:
-		ret = -EINVAL;
-		goto err;
-		break;
+		return -EINVAL;
 	}
 
+	ret = fwdt_io_access(fid.parameters.func, fid.io_address, &data);
+	if (ret)
+		return ret;
+
+	if (fid.parameters.func == GET_DATA_BYTE)
+		fid.io_byte = data;
+	else if (fid.parameters.func == GET_DATA_WORD)
+		fid.io_word = data;
+
 	if (unlikely(copy_to_user(fg, &fid, sizeof(struct fwdt_io_data))))
 		return -EFAULT;
 
+	return 0;
+}
+
+int handle_hardware_io_dword_cmd(fwdt_generic __user *fg)
+{
+	int ret;
+	struct fwdt_io_dword_data fid;
+
+	if (unlikely(copy_from_user(&fid, fg,
+				    sizeof(struct fwdt_io_dword_data))))
+		return -EFAULT;
+
+	if (fid.parameters.func != GET_DATA_DWORD &&
+	    fid.parameters.func != SET_DATA_DWORD)
+		return -EINVAL;
+
+	ret = fwdt_io_access(fid.parameters.func, fid.io_address,
+			     &fid.io_dword);
+	if (ret)
+		return ret;
+
+	if (unlikely(copy_to_user(fg, &fid, sizeof(struct fwdt_io_dword_data))))
+		return -EFAULT;
+
+	return 0;
+}
+
+static void fwdt_io_read_block(struct fwdt_io_block *fib, void *buf)
+{
+	u16 port = fib->io_address;
+	u32 i;
+
+	if (!(fib->flags & FWDT_IO_INCREMENT)) {
+		switch (fib->width) {
+		case 1:
+			insb(port, buf, fib->count);
+			break;
+		case 2:
+			insw(port, buf, fib->count);
+			break;
+		case 4:
+			insl(port, buf, fib->count);
+			break;
+		}
+		return;
+	}
+
+	for (i = 0; i < fib->count; i++, port += fib->width) {
+		switch (fib->width) {
+		case 1:
+			((u8 *)buf)[i] = inb(port);
+			break;
+		case 2:
+			((u16 *)buf)[i] = inw(port);
+			break;
+		case 4:
+			((u32 *)buf)[i] = inl(port);
+			break;
+		}
+	}
+}
+
+static void fwdt_io_write_block(struct fwdt_io_block *fib, const void *buf)
+{
+	u16 port = fib->io_address;
+	u32 i;
+
+	if (!(fib->flags & FWDT_IO_INCREMENT)) {
+		switch (fib->width) {
+		case 1:
+			outsb(port, buf, fib->count);
+			break;
+		case 2:
+			outsw(port, buf, fib->count);
+			break;
+		case 4:
+			outsl(port, buf, fib->count);
+			break;
+		}
+		return;
+	}
+
+	for (i = 0; i < fib->count; i++, port += fib->width) {
+		switch (fib->width) {
+		case 1:
+			outb(((const u8 *)buf)[i], port);
+			break;
+		case 2:
+			outw(((const u16 *)buf)[i], port);
+			break;
+		case 4:
+			outl(((const u32 *)buf)[i], port);
+			break;
+		}
+	}
+}
+
+int handle_hardware_io_block_cmd(fwdt_generic __user *fg)
+{
+	int ret = 0;
+	struct fwdt_io_block fib;
+	void __user *ubuf;
+	size_t size;
+	void *buf;
+
+	if (unlikely(copy_from_user(&fib, fg, sizeof(struct fwdt_io_block))))
+		return -EFAULT;
+
+	if (fib.width != 1 && fib.width != 2 && fib.width != 4)
+		return -EINVAL;
+
+	size = (size_t)fib.count * fib.width;
+	if (fib.count == 0 || size > FWDT_IO_BLOCK_MAX)
+		return -EINVAL;
+
+	if ((fib.flags & FWDT_IO_INCREMENT) && fib.io_address + size > 0x10000)
+		return -EINVAL;
+
+	ubuf = u64_to_user_ptr(fib.buffer);
+	switch (fib.parameters.func) {
+	case GET_DATA_BLOCK:
+		buf = kmalloc(size, GFP_KERNEL);
+		if (!buf)
+			return -ENOMEM;
+		mutex_lock(&fwdt_io_lock);
+		fwdt_io_read_block(&fib, buf);
+		mutex_unlock(&fwdt_io_lock);
+		if (copy_to_user(ubuf, buf, size))
+			ret = -EFAULT;
+		break;
+	case SET_DATA_BLOCK:
+		buf = memdup_user(ubuf, size);
+		if (IS_ERR(buf))
+			return PTR_ERR(buf);
+		mutex_lock(&fwdt_io_lock);
+		fwdt_io_write_block(&fib, buf);
+		mutex_unlock(&fwdt_io_lock);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	kfree(buf);
+	return ret;
+}
+
+static u32 fwdt_io_in(u16 port, u8 width)
+{
+	switch (width) {
+	case 1:
+		return inb(port);
+	case 2:
+		return inw(port);
+	default:
+		return inl(port);
+	}
+}
+
+static void fwdt_io_out(u32 data, u16 port, u8 width)
+{
+	switch (width) {
+	case 1:
+		outb(data, port);
+		break;
+	case 2:
+		outw(data, port);
+		break;
+	default:
+		outl(data, port);
+		break;
+	}
+}
+
+static bool fwdt_io_valid_width(u8 width)
+{
+	return width == 1 || width == 2 || width == 4;
+}
+
+int handle_hardware_io_index_cmd(fwdt_generic __user *fg)
+{
+	int ret = 0;
+	struct fwdt_io_index fii;
+	u32 *indices = NULL;
+	u32 *data;
+	unsigned long flags;
+	bool rtc, write;
+	u32 i, index;
+
+	if (unlikely(copy_from_user(&fii, fg, sizeof(struct fwdt_io_index))))
+		return -EFAULT;
+
+	switch (fii.parameters.func) {
+	case GET_DATA_BLOCK:
+		write = false;
+		break;
+	case SET_DATA_BLOCK:
+		write = true;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!fwdt_io_valid_width(fii.index_width) ||
+	    !fwdt_io_valid_width(fii.data_width))
+		return -EINVAL;
+
+	if (fii.count == 0 || fii.count > FWDT_IO_INDEX_MAX)
+		return -EINVAL;
+
+	/* the kernel's own 0xCF8 accesses use a lock fwdt cannot take */
+	if (fii.index_port == 0xCF8)
+		return -EINVAL;
+
+	if (fii.indices) {
+		indices = memdup_user(u64_to_user_ptr(fii.indices),
+				      fii.count * sizeof(u32));
+		if (IS_ERR(indices))
+			return PTR_ERR(indices);
+	}
+
+	if (write)
+		data = memdup_user(u64_to_user_ptr(fii.buffer),
+				   fii.count * sizeof(u32));
+	else
+		data = kcalloc(fii.count, sizeof(u32), GFP_KERNEL);
+	if (IS_ERR_OR_NULL(data)) {
+		ret = data ? PTR_ERR(data) : -ENOMEM;
+		goto err;
+	}
+
+	/*
+	 * The RTC pairs are shared with the kernel's own CMOS accessors. Other
+	 * pairs are claimed as a muxed region, as Super I/O drivers do.
+	 */
+	rtc = fii.index_port == RTC_PORT(0) || fii.index_port == RTC_PORT(2);
+	if (!rtc && !request_muxed_region(fii.index_port, 1, "fwdt")) {
+		ret = -EBUSY;
+		goto err_data;
+	}
+
+	mutex_lock(&fwdt_io_lock);
+	if (rtc)
+		spin_lock_irqsave(&rtc_lock, flags);
+	for (i = 0; i < fii.count; i++) {
+		index = indices ? indices[i] : fii.first_index + i;
+		fwdt_io_out(index, fii.index_port, fii.index_width);
+		if (write)
+			fwdt_io_out(data[i], fii.data_port, fii.data_width);
+		else
+			data[i] = fwdt_io_in(fii.data_port, fii.data_width);
+	}
+	if (rtc)
+		spin_unlock_irqrestore(&rtc_lock, flags);
+	mutex_unlock(&fwdt_io_lock);
+
+	if (!rtc)
+		release_region(fii.index_port, 1);
+
+	if (!write && copy_to_user(u64_to_user_ptr(fii.buffer), data,
+				   fii.count * sizeof(u32)))
+		ret = -EFAULT;
+
+err_data:
+	kfree(data);
 err:
+	kfree(indices);
 	return ret;
 }
 
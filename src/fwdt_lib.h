@@ -18,8 +18,28 @@
 #define __FWDT_LIB_H__
 
 #include <linux/acpi.h>
+#include <linux/idr.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
 #include "fwdt.h"
 
+struct cpumask;
+struct dentry;
+struct pci_dev;
+struct vm_area_struct;
+
+extern struct dentry *fwdt_debugfs_dir;
+
+/* Per-open state of /dev/fwdt, lock serializes updates to it */
+struct fwdt_context {
+	struct mutex lock;
+	u32 cache_mode;
+	struct idr snapshots;
+	u32 num_snapshots;
+	u64 snapshot_bytes;
+	struct list_head bar_maps;
+};
+
 #ifdef CONFIG_ACPI
 
 #define ACPI_PATH_SIZE  80
@@ -54,7 +74,14 @@ ssize_t ec_write_data(struct device *dev, struct device_attribute *attr, const c
 ssize_t ec_read_addr(struct device *dev, struct device_attribute *attr, char *buf);
 ssize_t ec_write_addr(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 ssize_t ec_exec_qmethod(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+int fwdt_ec_access(u16 func, u8 addr, u8 *data);
 int handle_acpi_ec_cmd(fwdt_generic __user *fg);
+int handle_acpi_ec_block_cmd(fwdt_generic __user *fg);
+int handle_acpi_ec_update_cmd(fwdt_generic __user *fg);
+
+/* ACPI EC event capture */
+void fwdt_ec_event_init(void);
+void fwdt_ec_event_exit(void);
 
 #endif
 
@@ -63,7 +90,22 @@ ssize_t mem_read_address(struct device *dev, struct device_attribute *attr, char
 ssize_t mem_write_address(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 ssize_t mem_read_data(struct device *dev, struct device_attribute *attr, char *buf);
 ssize_t mem_write_data(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+ssize_t mem_window_read(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count);
+ssize_t mem_window_write(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count);
+int fwdt_mem_access(u16 func, u64 addr, u32 *data);
+int fwdt_mem_copy(u64 addr, void *buf, size_t len, u32 width, bool write);
 int handle_hardware_memory_cmd(fwdt_generic __user *fg);
+int handle_hardware_memory_block_cmd(fwdt_generic __user *fg);
+int handle_memory_scan_cmd(fwdt_generic __user *fg);
+int handle_memory_map_cmd(struct fwdt_context *ctx, fwdt_generic __user *fg);
+int handle_memory_snapshot_cmd(struct fwdt_context *ctx, fwdt_generic __user *fg);
+void fwdt_mem_release(struct fwdt_context *ctx);
+int fwdt_mem_mmap(struct fwdt_context *ctx, struct vm_area_struct *vma);
+void fwdt_mem_init(void);
+void fwdt_mem_exit(void);
+
+/* Batch functions */
+int handle_batch_cmd(fwdt_generic __user *fg);
 
 #ifdef CONFIG_X86
 
@@ -74,16 +116,29 @@ ssize_t iow_read_data(struct device *dev, struct device_attribute *attr, char *b
 ssize_t iow_write_data(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 ssize_t iob_read_data(struct device *dev, struct device_attribute *attr, char *buf);
 ssize_t iob_write_data(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+int fwdt_io_access(u16 func, u16 port, u32 *data);
 int handle_hardware_io_cmd(fwdt_generic __user *fg);
+int handle_hardware_io_dword_cmd(fwdt_generic __user *fg);
+int handle_hardware_io_block_cmd(fwdt_generic __user *fg);
+int handle_hardware_io_index_cmd(fwdt_generic __user *fg);
 
 /* CMOS functions */
 ssize_t cmos_read_data(struct device *dev, struct device_attribute *attr, char *buf);
 ssize_t cmos_write_addr(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+ssize_t cmos_write_data(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+int fwdt_cmos_access(u16 func, u8 addr, u8 *data);
 int handle_hardware_cmos_cmd(fwdt_generic __user *fg);
+int handle_hardware_cmos_block_cmd(fwdt_generic __user *fg);
 
 /* MSR functions */
 ssize_t msr_read_data(struct device *dev, struct device_attribute *attr, char *buf);
 ssize_t msr_set_register(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+int fwdt_msr_get_cpumask(struct cpumask *mask, u64 ucpumask, u32 mask_size, u32 num_cpus);
+int handle_msr_cmd(fwdt_generic __user *fg);
+int handle_msr_list_cmd(fwdt_generic __user *fg);
+int handle_msr_sampler_cmd(fwdt_generic __user *fg);
+void fwdt_msr_sampler_init(void);
+void fwdt_msr_sampler_exit(void);
 
 #endif
 
@@ -92,6 +147,7 @@ typedef struct {
 	u16 vid;
 	u16 did;
 	u8 offset;
+	struct pci_dev *pdev;
 } Pci_dev;
 
 #ifdef CONFIG_PCI
@@ -102,6 +158,16 @@ ssize_t pci_read_offset(struct device *dev, struct device_attribute *attr, char
 ssize_t pci_write_offset(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 ssize_t pci_write_ids(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 ssize_t pci_read_ids(struct device *dev, struct device_attribute *attr, char *buf);
+int fwdt_pci_access(u16 func, u64 address, u32 *data);
+struct pci_dev *fwdt_pci_get_dev(u16 segment, u8 bus, u8 devfn);
+int fwdt_pci_config_copy(struct pci_dev *pdev, int where, void *buf, int len, u32 width, u32 flags, bool write);
+int handle_pci_config_cmd(fwdt_generic __user *fg);
+int handle_pci_inventory_cmd(fwdt_generic __user *fg);
+int handle_pci_cap_cmd(fwdt_generic __user *fg);
+int handle_pci_bar_cmd(struct fwdt_context *ctx, fwdt_generic __user *fg);
+void fwdt_pci_release(struct fwdt_context *ctx);
+void fwdt_pci_init(void);
+void fwdt_pci_exit(void);
 
 #endif
 
@@ -17,22 +17,207 @@
 #define pr_fmt(fmt) "fwdt: " fmt
 
 #include "fwdt_lib.h"
+#include <linux/debugfs.h>
+#include <linux/io-64-nonatomic-lo-hi.h>
 #include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
 #include <linux/platform_device.h>
+#include <linux/sched/signal.h>
 #include <linux/semaphore.h>
+#include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <asm/unaligned.h>
 
-static u32 mem_addr;
+/* Upper bound of physical memory kept mapped by the window cache */
+#define FWDT_MEM_CACHE_SIZE (4 * 1024 * 1024)
+
+/* Block transfers are mapped and bounced in chunks of this size */
+#define FWDT_MEM_CHUNK_SIZE (64 * 1024)
+
+struct fwdt_mem_window {
+	struct list_head node;
+	phys_addr_t base;
+	size_t size;
+	void __iomem *virt;
+};
+
+/* Mapped windows, most recently used first */
+static LIST_HEAD(mem_windows);
+static DEFINE_MUTEX(fwdt_mem_lock);
+static size_t mem_cache_mapped;
+static u64 mem_cache_hits;
+static u64 mem_cache_misses;
+static u64 mem_cache_evictions;
+
+static void fwdt_mem_evict(struct fwdt_mem_window *win)
+{
+	list_del(&win->node);
+	mem_cache_mapped -= win->size;
+	iounmap(win->virt);
+	kfree(win);
+}
+
+/*
+ * Return a virtual address for [addr, addr + len) from the window cache,
+ * mapping the covering pages on a miss. fwdt_mem_lock must be held for as
+ * long as the returned pointer is used.
+ */
+static void __iomem *fwdt_mem_map(phys_addr_t addr, size_t len)
+{
+	struct fwdt_mem_window *win;
+	phys_addr_t base;
+	size_t size;
+
+	list_for_each_entry(win, &mem_windows, node) {
+		if (addr >= win->base && addr + len <= win->base + win->size) {
+			list_move(&win->node, &mem_windows);
+			mem_cache_hits++;
+			return win->virt + (addr - win->base);
+		}
+	}
+
+	mem_cache_misses++;
+
+	base = round_down(addr, PAGE_SIZE);
+	size = round_up(addr + len, PAGE_SIZE) - base;
+	if (size > FWDT_MEM_CACHE_SIZE)
+		return NULL;
+
+	while (mem_cache_mapped + size > FWDT_MEM_CACHE_SIZE) {
+		fwdt_mem_evict(list_last_entry(&mem_windows,
+					       struct fwdt_mem_window, node));
+		mem_cache_evictions++;
+	}
+
+	win = kmalloc(sizeof(struct fwdt_mem_window), GFP_KERNEL);
+	if (!win)
+		return NULL;
+
+	win->virt = ioremap(base, size);
+	if (!win->virt) {
+		kfree(win);
+		return NULL;
+	}
+
+	win->base = base;
+	win->size = size;
+	list_add(&win->node, &mem_windows);
+	mem_cache_mapped += size;
+
+	return win->virt + (addr - base);
+}
+
+static void fwdt_mem_read_io(void *dst, const void __iomem *src, size_t len,
+			     u32 width)
+{
+	size_t i;
+
+	switch (width) {
+	case 1:
+		for (i = 0; i < len; i++)
+			*(u8 *)(dst + i) = readb(src + i);
+		break;
+	case 2:
+		for (i = 0; i < len; i += 2)
+			*(u16 *)(dst + i) = readw(src + i);
+		break;
+	case 4:
+		for (i = 0; i < len; i += 4)
+			*(u32 *)(dst + i) = readl(src + i);
+		break;
+	case 8:
+		for (i = 0; i < len; i += 8)
+			*(u64 *)(dst + i) = readq(src + i);
+		break;
+	default:
+		memcpy_fromio(dst, src, len);
+		break;
+	}
+}
+
+static void fwdt_mem_write_io(void __iomem *dst, const void *src, size_t len,
+			      u32 width)
+{
+	size_t i;
+
+	switch (width) {
+	case 1:
+		for (i = 0; i < len; i++)
+			writeb(*(u8 *)(src + i), dst + i);
+		break;
+	case 2:
+		for (i = 0; i < len; i += 2)
+			writew(*(u16 *)(src + i), dst + i);
+		break;
+	case 4:
+		for (i = 0; i < len; i += 4)
+			writel(*(u32 *)(src + i), dst + i);
+		break;
+	case 8:
+		for (i = 0; i < len; i += 8)
+			writeq(*(u64 *)(src + i), dst + i);
+		break;
+	default:
+		memcpy_toio(dst, src, len);
+		break;
+	}
+}
+
+/*
+ * Copy between physical memory and a kernel buffer. addr and len must be
+ * multiples of width when width is not 0.
+ */
+int fwdt_mem_copy(u64 addr, void *buf, size_t len, u32 width, bool write)
+{
+	void __iomem *mem;
+	size_t chunk;
+
+	if (width != 0 && width != 1 && width != 2 && width != 4 && width != 8)
+		return -EINVAL;
+
+	if (width && ((addr | len) & (width - 1)))
+		return -EINVAL;
+
+	while (len) {
+		/* stop chunks at chunk-size boundaries so windows get reused */
+		chunk = FWDT_MEM_CHUNK_SIZE - (addr & (FWDT_MEM_CHUNK_SIZE - 1));
+		chunk = min(chunk, len);
+
+		mutex_lock(&fwdt_mem_lock);
+		mem = fwdt_mem_map(addr, chunk);
+		if (!mem) {
+			mutex_unlock(&fwdt_mem_lock);
+			return -ENOMEM;
+		}
+
+		if (write)
+			fwdt_mem_write_io(mem, buf, chunk, width);
+		else
+			fwdt_mem_read_io(buf, mem, chunk, width);
+		mutex_unlock(&fwdt_mem_lock);
+
+		addr += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+static u64 mem_addr;
 ssize_t mem_read_address(struct device *dev, struct device_attribute *attr,
 			 char *buf)
 {
-	return sprintf(buf, "0x%08x\n", mem_addr);
+	return sprintf(buf, "0x%08llx\n", mem_addr);
 }
 
 ssize_t mem_write_address(struct device *dev, struct device_attribute *attr,
 			  const char *buf, size_t count)
 {
-	mem_addr = simple_strtoul(buf, NULL, 16);
+	mem_addr = simple_strtoull(buf, NULL, 16);
 
 	return count;
 }
@@ -40,12 +225,12 @@ ssize_t mem_write_address(struct device *dev, struct device_attribute *attr,
 ssize_t mem_read_data(struct device *dev, struct device_attribute *attr,
 		      char *buf)
 {
-	volatile u32 *mem;
+	int ret;
 	u32 data;
 
-	mem = ioremap(mem_addr, 8);
-	data = *mem;
-	iounmap(mem);
+	ret = fwdt_mem_access(GET_DATA_DWORD, mem_addr, &data);
+	if (ret)
+		return ret;
 
 	return sprintf(buf, "0x%08x\n", data);
 }
@@ -53,46 +238,493 @@ ssize_t mem_read_data(struct device *dev, struct device_attribute *attr,
 ssize_t mem_write_data(struct device *dev, struct device_attribute *attr,
 		       const char *buf, size_t count)
 {
-	volatile u32 *mem;
+	int ret;
 	u32 data;
 
 	data = simple_strtoul(buf, NULL, 16) & 0xFFFFFFFF;
 
-	mem = ioremap(mem_addr, 8);
-	*mem = data;
-	iounmap(mem);
+	ret = fwdt_mem_access(SET_DATA_DWORD, mem_addr, &data);
+	if (ret)
+		return ret;
 
 	return count;
 }
 
-int handle_hardware_memory_cmd(fwdt_generic __user *fg)
+/* mem_window: the file offset is the physical address */
+static u32 mem_window_width(loff_t off, size_t count)
 {
-	int ret = 0;
-	volatile u64 *mem;
-	struct fwdt_mem_data fmd;
+	return ((off | count) & 3) ? 1 : 4;
+}
 
-	if (unlikely(copy_from_user(&fmd, fg, sizeof(struct fwdt_mem_data))))
-		return -EFAULT;
+ssize_t mem_window_read(struct file *filp, struct kobject *kobj,
+			struct bin_attribute *attr, char *buf, loff_t off,
+			size_t count)
+{
+	int ret;
 
-	mem = ioremap(fmd.mem_address, 8);
+	ret = fwdt_mem_copy(off, buf, count, mem_window_width(off, count),
+			    false);
+	if (ret)
+		return ret;
+
+	return count;
+}
+
+ssize_t mem_window_write(struct file *filp, struct kobject *kobj,
+			 struct bin_attribute *attr, char *buf, loff_t off,
+			 size_t count)
+{
+	int ret;
+
+	ret = fwdt_mem_copy(off, buf, count, mem_window_width(off, count),
+			    true);
+	if (ret)
+		return ret;
+
+	return count;
+}
 
-	switch (fg->parameters.func) {
+int fwdt_mem_access(u16 func, u64 addr, u32 *data)
+{
+	void __iomem *mem;
+	int ret = 0;
+
+	mutex_lock(&fwdt_mem_lock);
+	mem = fwdt_mem_map(addr, sizeof(u32));
+	if (!mem) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	switch (func) {
 	case GET_DATA_DWORD:
-		fmd.mem_data = *mem;
+		*data = readl(mem);
 		break;
 	case SET_DATA_DWORD:
-		*mem = fmd.mem_data;
+		writel(*data, mem);
 		break;
 	default:
 		ret = -EINVAL;
-		goto err;
 		break;
 	}
 
+err:
+	mutex_unlock(&fwdt_mem_lock);
+	return ret;
+}
+
+int handle_hardware_memory_cmd(fwdt_generic __user *fg)
+{
+	int ret;
+	struct fwdt_mem_data fmd;
+
+	if (unlikely(copy_from_user(&fmd, fg, sizeof(struct fwdt_mem_data))))
+		return -EFAULT;
+
+	ret = fwdt_mem_access(fmd.parameters.func, fmd.mem_address,
+			      &fmd.mem_data);
+	if (ret)
+		return ret;
+
 	if (unlikely(copy_to_user(fg, &fmd, sizeof(struct fwdt_mem_data))))
-		ret = -EFAULT;
+		return -EFAULT;
+
+	return 0;
+}
+
+int handle_hardware_memory_block_cmd(fwdt_generic __user *fg)
+{
+	int ret = 0;
+	struct fwdt_mem_block fmb;
+	void __user *ubuf;
+	void *bounce;
+	size_t done, chunk;
+	bool write;
+
+	if (unlikely(copy_from_user(&fmb, fg, sizeof(struct fwdt_mem_block))))
+		return -EFAULT;
+
+	switch (fmb.parameters.func) {
+	case GET_DATA_BLOCK:
+		write = false;
+		break;
+	case SET_DATA_BLOCK:
+		write = true;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (fmb.length == 0 || fmb.length > FWDT_MEM_BLOCK_MAX)
+		return -EINVAL;
+
+	bounce = kmalloc(FWDT_MEM_CHUNK_SIZE, GFP_KERNEL);
+	if (!bounce)
+		return -ENOMEM;
+
+	ubuf = u64_to_user_ptr(fmb.buffer);
+	for (done = 0; done < fmb.length; done += chunk) {
+		chunk = min_t(size_t, fmb.length - done, FWDT_MEM_CHUNK_SIZE);
+
+		if (write && copy_from_user(bounce, ubuf + done, chunk)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = fwdt_mem_copy(fmb.mem_address + done, bounce, chunk,
+				    fmb.width, write);
+		if (ret)
+			break;
+
+		if (!write && copy_to_user(ubuf + done, bounce, chunk)) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	kfree(bounce);
+	return ret;
+}
+
+/*
+ * Scan a chunk for the pattern at offsets aligned to align. The first eight
+ * pattern bytes are compared as one masked word before falling back to
+ * memcmp for longer patterns. buf must have 8 bytes of slack after len.
+ */
+static int fwdt_mem_scan_chunk(struct fwdt_mem_scan *fms, u64 base,
+			       const u8 *buf, size_t len, size_t limit,
+			       u64 __user *hits)
+{
+	size_t head = min_t(size_t, fms->pattern_len, sizeof(u64));
+	u64 mask = head == sizeof(u64) ? ~0ULL : (1ULL << (head * 8)) - 1;
+	u64 first = 0;
+	size_t off;
+
+	memcpy(&first, fms->pattern, head);
+	first = le64_to_cpu(first);
+
+	off = round_up(base, fms->align) - base;
+	for (; off < limit && off + fms->pattern_len <= len; off += fms->align) {
+		if ((get_unaligned_le64(buf + off) & mask) != first)
+			continue;
+
+		if (fms->pattern_len > head &&
+		    memcmp(buf + off + head, fms->pattern + head,
+			   fms->pattern_len - head))
+			continue;
+
+		if (put_user(base + off, hits + fms->num_hits))
+			return -EFAULT;
+
+		if (++fms->num_hits == fms->max_hits)
+			break;
+	}
+
+	return 0;
+}
+
+int handle_memory_scan_cmd(fwdt_generic __user *fg)
+{
+	int ret = 0;
+	struct fwdt_mem_scan fms;
+	u64 addr, end;
+	size_t chunk, len;
+	u8 *buf;
+
+	if (unlikely(copy_from_user(&fms, fg, sizeof(struct fwdt_mem_scan))))
+		return -EFAULT;
+
+	if (fms.pattern_len == 0 ||
+	    fms.pattern_len > FWDT_MEM_SCAN_PATTERN_MAX ||
+	    fms.length < fms.pattern_len || fms.max_hits == 0 ||
+	    fms.length > U64_MAX - fms.mem_address)
+		return -EINVAL;
+
+	if (fms.align == 0)
+		fms.align = 1;
+	if (!is_power_of_2(fms.align) || fms.align > FWDT_MEM_CHUNK_SIZE)
+		return -EINVAL;
+
+	/* room for the pattern overlapping the next chunk plus word slack */
+	len = FWDT_MEM_CHUNK_SIZE + FWDT_MEM_SCAN_PATTERN_MAX + sizeof(u64);
+	buf = kmalloc(len, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	fms.num_hits = 0;
+	end = fms.mem_address + fms.length;
+	for (addr = fms.mem_address; addr < end; addr += chunk) {
+		chunk = min_t(u64, end - addr, FWDT_MEM_CHUNK_SIZE);
+		len = min_t(u64, end - addr, chunk + fms.pattern_len - 1);
+
+		ret = fwdt_mem_copy(addr, buf, len, 0, false);
+		if (ret)
+			break;
+
+		ret = fwdt_mem_scan_chunk(&fms, addr, buf, len, chunk,
+					  u64_to_user_ptr(fms.hits));
+		if (ret || fms.num_hits == fms.max_hits)
+			break;
+
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+
+	kfree(buf);
+	if (ret)
+		return ret;
+
+	if (unlikely(copy_to_user(fg, &fms, sizeof(struct fwdt_mem_scan))))
+		return -EFAULT;
+
+	return 0;
+}
+
+struct fwdt_mem_snapshot_buf {
+	u64 mem_address;
+	u64 length;
+	u64 *data;
+};
+
+static void fwdt_mem_free_snapshot(struct fwdt_mem_snapshot_buf *snap)
+{
+	vfree(snap->data);
+	kfree(snap);
+}
+
+static int fwdt_mem_capture_snapshot(struct fwdt_context *ctx,
+				     struct fwdt_mem_snapshot *fms)
+{
+	struct fwdt_mem_snapshot_buf *snap;
+	int ret;
+
+	if (fms->length == 0 || fms->length > FWDT_MEM_SNAPSHOT_MAX ||
+	    (fms->length & 7) || !IS_ALIGNED(fms->mem_address, 4))
+		return -EINVAL;
+
+	if (ctx->num_snapshots >= FWDT_MEM_SNAPSHOT_COUNT ||
+	    ctx->snapshot_bytes + fms->length > FWDT_MEM_SNAPSHOT_TOTAL)
+		return -ENOSPC;
+
+	snap = kzalloc(sizeof(struct fwdt_mem_snapshot_buf), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	snap->mem_address = fms->mem_address;
+	snap->length = fms->length;
+	snap->data = vmalloc(snap->length);
+	if (!snap->data) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	ret = fwdt_mem_copy(snap->mem_address, snap->data, snap->length, 4,
+			    false);
+	if (ret)
+		goto err;
+
+	ret = idr_alloc(&ctx->snapshots, snap, 1, 0, GFP_KERNEL);
+	if (ret < 0)
+		goto err;
+
+	fms->handle = ret;
+	ctx->num_snapshots++;
+	ctx->snapshot_bytes += snap->length;
+	return 0;
 
 err:
-	iounmap(mem);
+	fwdt_mem_free_snapshot(snap);
 	return ret;
 }
+
+static int fwdt_mem_diff_snapshot(struct fwdt_context *ctx,
+				  struct fwdt_mem_snapshot *fms)
+{
+	struct fwdt_mem_snapshot_buf *snap;
+	struct fwdt_mem_change change;
+	struct fwdt_mem_change __user *changes;
+	u64 *cur;
+	size_t i;
+	int ret;
+
+	snap = idr_find(&ctx->snapshots, fms->handle);
+	if (!snap)
+		return -ENOENT;
+
+	cur = vmalloc(snap->length);
+	if (!cur)
+		return -ENOMEM;
+
+	ret = fwdt_mem_copy(snap->mem_address, cur, snap->length, 4, false);
+	if (ret)
+		goto err;
+
+	changes = u64_to_user_ptr(fms->changes);
+	fms->mem_address = snap->mem_address;
+	fms->length = snap->length;
+	fms->num_changes = 0;
+	for (i = 0; i < snap->length / sizeof(u64); i++) {
+		if (cur[i] == snap->data[i])
+			continue;
+
+		if (fms->num_changes < fms->max_changes) {
+			change.offset = i * sizeof(u64);
+			change.old_data = snap->data[i];
+			change.new_data = cur[i];
+			if (copy_to_user(changes + fms->num_changes, &change,
+					 sizeof(struct fwdt_mem_change))) {
+				ret = -EFAULT;
+				goto err;
+			}
+		}
+		fms->num_changes++;
+	}
+
+	if (fms->flags & FWDT_SNAPSHOT_UPDATE)
+		swap(snap->data, cur);
+
+err:
+	vfree(cur);
+	return ret;
+}
+
+int handle_memory_snapshot_cmd(struct fwdt_context *ctx,
+			       fwdt_generic __user *fg)
+{
+	int ret;
+	struct fwdt_mem_snapshot fms;
+	struct fwdt_mem_snapshot_buf *snap;
+
+	if (unlikely(copy_from_user(&fms, fg, sizeof(struct fwdt_mem_snapshot))))
+		return -EFAULT;
+
+	mutex_lock(&ctx->lock);
+	switch (fms.parameters.func) {
+	case CAPTURE_SNAPSHOT:
+		ret = fwdt_mem_capture_snapshot(ctx, &fms);
+		break;
+	case DIFF_SNAPSHOT:
+		ret = fwdt_mem_diff_snapshot(ctx, &fms);
+		break;
+	case RELEASE_SNAPSHOT:
+		snap = idr_remove(&ctx->snapshots, fms.handle);
+		if (snap) {
+			ctx->num_snapshots--;
+			ctx->snapshot_bytes -= snap->length;
+			fwdt_mem_free_snapshot(snap);
+		}
+		ret = snap ? 0 : -ENOENT;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	mutex_unlock(&ctx->lock);
+
+	if (ret)
+		return ret;
+
+	if (unlikely(copy_to_user(fg, &fms, sizeof(struct fwdt_mem_snapshot))))
+		return -EFAULT;
+
+	return 0;
+}
+
+void fwdt_mem_release(struct fwdt_context *ctx)
+{
+	struct fwdt_mem_snapshot_buf *snap;
+	int id;
+
+	idr_for_each_entry(&ctx->snapshots, snap, id)
+		fwdt_mem_free_snapshot(snap);
+}
+
+int handle_memory_map_cmd(struct fwdt_context *ctx, fwdt_generic __user *fg)
+{
+	int ret = 0;
+	struct fwdt_mem_map_data fmm;
+
+	if (unlikely(copy_from_user(&fmm, fg, sizeof(struct fwdt_mem_map_data))))
+		return -EFAULT;
+
+	mutex_lock(&ctx->lock);
+	switch (fmm.parameters.func) {
+	case GET_CACHE_MODE:
+		fmm.cache_mode = ctx->cache_mode;
+		break;
+	case SET_CACHE_MODE:
+		if (fmm.cache_mode > FWDT_CACHE_WB)
+			ret = -EINVAL;
+		else
+			ctx->cache_mode = fmm.cache_mode;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	mutex_unlock(&ctx->lock);
+
+	if (ret)
+		return ret;
+
+	if (unlikely(copy_to_user(fg, &fmm, sizeof(struct fwdt_mem_map_data))))
+		return -EFAULT;
+
+	return 0;
+}
+
+/* The mmap offset is the physical address of the window */
+int fwdt_mem_mmap(struct fwdt_context *ctx, struct vm_area_struct *vma)
+{
+	size_t size = vma->vm_end - vma->vm_start;
+	phys_addr_t offset = (phys_addr_t)vma->vm_pgoff << PAGE_SHIFT;
+	u32 cache_mode;
+
+	/* reject ranges that do not fit in phys_addr_t */
+	if (offset >> PAGE_SHIFT != vma->vm_pgoff || offset + size - 1 < offset)
+		return -EINVAL;
+
+	mutex_lock(&ctx->lock);
+	cache_mode = ctx->cache_mode;
+	mutex_unlock(&ctx->lock);
+
+	switch (cache_mode) {
+	case FWDT_CACHE_UC:
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+		break;
+	case FWDT_CACHE_WC:
+		vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+		break;
+	case FWDT_CACHE_WB:
+	default:
+		break;
+	}
+
+	return remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff, size,
+			       vma->vm_page_prot);
+}
+
+void fwdt_mem_init(void)
+{
+	debugfs_create_u64("mem_cache_hits", 0444, fwdt_debugfs_dir,
+			   &mem_cache_hits);
+	debugfs_create_u64("mem_cache_misses", 0444, fwdt_debugfs_dir,
+			   &mem_cache_misses);
+	debugfs_create_u64("mem_cache_evictions", 0444, fwdt_debugfs_dir,
+			   &mem_cache_evictions);
+	debugfs_create_size_t("mem_cache_mapped", 0444, fwdt_debugfs_dir,
+			      &mem_cache_mapped);
+}
+
+void fwdt_mem_exit(void)
+{
+	struct fwdt_mem_window *win, *tmp;
+
+	mutex_lock(&fwdt_mem_lock);
+	list_for_each_entry_safe(win, tmp, &mem_windows, node)
+		fwdt_mem_evict(win);
+	mutex_unlock(&fwdt_mem_lock);
+}
@@ -18,9 +18,15 @@
 
 #include "fwdt_lib.h"
 #include <asm/msr.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/platform_device.h>
 #include <linux/semaphore.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/uaccess.h>
 
 #ifdef CONFIG_X86
 
@@ -28,10 +34,12 @@ static int msr_register;
 ssize_t msr_read_data(struct device *dev, struct device_attribute *attr,
 		      char *buf)
 {
-	u32 h, l;
-	rdmsr(msr_register, l, h);
+	u64 data;
 
-	return sprintf(buf, "0x%08x%08x\n", (h << 16), l);
+	if (rdmsrl_safe(msr_register, &data))
+		return -EIO;
+
+	return sprintf(buf, "0x%016llx\n", data);
 }
 
 ssize_t msr_set_register(struct device *dev, struct device_attribute *attr,
@@ -42,4 +50,178 @@ ssize_t msr_set_register(struct device *dev, struct device_attribute *attr,
 	return count;
 }
 
+struct fwdt_msr_info {
+	u32 msr;
+	bool write;
+	struct fwdt_msr_value *values;
+};
+
+/* Runs on every selected CPU with interrupts disabled */
+static void fwdt_msr_ipi(void *data)
+{
+	struct fwdt_msr_info *info = data;
+	struct fwdt_msr_value *v = &info->values[smp_processor_id()];
+
+	if (info->write)
+		v->err = wrmsrl_safe(info->msr, v->value);
+	else
+		v->err = rdmsrl_safe(info->msr, &v->value);
+}
+
+/*
+ * Copy a user CPU bitmap into mask, keeping only online CPUs that have a
+ * slot in a num_cpus sized result array.
+ */
+int fwdt_msr_get_cpumask(struct cpumask *mask, u64 ucpumask, u32 mask_size,
+			 u32 num_cpus)
+{
+	unsigned int cpu;
+
+	cpumask_clear(mask);
+	if (copy_from_user(cpumask_bits(mask), u64_to_user_ptr(ucpumask),
+			   min_t(size_t, mask_size, cpumask_size())))
+		return -EFAULT;
+
+	cpumask_and(mask, mask, cpu_online_mask);
+	for_each_cpu(cpu, mask) {
+		if (cpu >= num_cpus)
+			cpumask_clear_cpu(cpu, mask);
+	}
+
+	return cpumask_empty(mask) ? -EINVAL : 0;
+}
+
+int handle_msr_cmd(fwdt_generic __user *fg)
+{
+	int ret;
+	struct fwdt_msr_data fmd;
+	struct fwdt_msr_info info;
+	void __user *uvalues;
+	cpumask_var_t mask;
+	size_t size;
+
+	if (unlikely(copy_from_user(&fmd, fg, sizeof(struct fwdt_msr_data))))
+		return -EFAULT;
+
+	switch (fmd.parameters.func) {
+	case READ_MSR:
+		info.write = false;
+		break;
+	case WRITE_MSR:
+		info.write = true;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	fmd.num_cpus = min_t(u32, fmd.num_cpus, nr_cpu_ids);
+	if (fmd.num_cpus == 0)
+		return -EINVAL;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	uvalues = u64_to_user_ptr(fmd.values);
+	size = fmd.num_cpus * sizeof(struct fwdt_msr_value);
+	info.msr = fmd.msr;
+	info.values = vmemdup_user(uvalues, size);
+	if (IS_ERR(info.values)) {
+		ret = PTR_ERR(info.values);
+		goto err_values;
+	}
+
+	cpus_read_lock();
+	ret = fwdt_msr_get_cpumask(mask, fmd.cpumask, fmd.mask_size,
+				   fmd.num_cpus);
+	if (!ret)
+		on_each_cpu_mask(mask, fwdt_msr_ipi, &info, true);
+	cpus_read_unlock();
+
+	if (!ret && copy_to_user(uvalues, info.values, size))
+		ret = -EFAULT;
+
+	kvfree(info.values);
+err_values:
+	free_cpumask_var(mask);
+	return ret;
+}
+
+struct fwdt_msr_list_info {
+	u32 *msrs;
+	u32 num_msrs;
+	struct fwdt_msr_value *values;
+};
+
+/* One cross-call per CPU reads the whole list back to back */
+static void fwdt_msr_list_ipi(void *data)
+{
+	struct fwdt_msr_list_info *info = data;
+	struct fwdt_msr_value *row;
+	u32 i;
+
+	row = &info->values[smp_processor_id() * info->num_msrs];
+	for (i = 0; i < info->num_msrs; i++)
+		row[i].err = rdmsrl_safe(info->msrs[i], &row[i].value);
+}
+
+int handle_msr_list_cmd(fwdt_generic __user *fg)
+{
+	int ret;
+	struct fwdt_msr_list fml;
+	struct fwdt_msr_list_info info;
+	void __user *uvalues;
+	cpumask_var_t mask;
+	size_t size;
+
+	if (unlikely(copy_from_user(&fml, fg, sizeof(struct fwdt_msr_list))))
+		return -EFAULT;
+
+	if (fml.parameters.func != READ_MSR)
+		return -EINVAL;
+
+	if (fml.num_msrs == 0 || fml.num_msrs > FWDT_MSR_LIST_MAX)
+		return -EINVAL;
+
+	fml.num_cpus = min_t(u32, fml.num_cpus, nr_cpu_ids);
+	if (fml.num_cpus == 0)
+		return -EINVAL;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	info.num_msrs = fml.num_msrs;
+	info.msrs = memdup_user(u64_to_user_ptr(fml.msrs),
+				fml.num_msrs * sizeof(u32));
+	if (IS_ERR(info.msrs)) {
+		ret = PTR_ERR(info.msrs);
+		goto err_msrs;
+	}
+
+	uvalues = u64_to_user_ptr(fml.values);
+	size = (size_t)fml.num_cpus * fml.num_msrs *
+	       sizeof(struct fwdt_msr_value);
+	info.values = vmemdup_user(uvalues, size);
+	if (IS_ERR(info.values)) {
+		ret = PTR_ERR(info.values);
+		goto err_values;
+	}
+
+	cpus_read_lock();
+	ret = fwdt_msr_get_cpumask(mask, fml.cpumask, fml.mask_size,
+				   fml.num_cpus);
+	if (!ret)
+		on_each_cpu_mask(mask, fwdt_msr_list_ipi, &info, true);
+	cpus_read_unlock();
+
+	if (!ret && copy_to_user(uvalues, info.values, size))
+		ret = -EFAULT;
+
+	kvfree(info.values);
+err_values:
+	kfree(info.msrs);
+err_msrs:
+	free_cpumask_var(mask);
+	return ret;
+}
+
 #endif
@@ -0,0 +1,374 @@
+/*
+ * FWDT MSR sampler driver
+ *
+ * Copyright(C) 2016-2021 Canonical Ltd.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#define pr_fmt(fmt) "fwdt: " fmt
+
+#include "fwdt_lib.h"
+#include <asm/msr.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/hrtimer.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#ifdef CONFIG_X86
+
+/*
+ * Every sampled CPU owns an hrtimer pinned to it and a ring of samples.
+ * The timer callback is the only producer and the reader the only
+ * consumer of a ring, so head and tail are published with release
+ * stores and no lock is taken on the sampling path.
+ */
+struct fwdt_msr_ring {
+	struct hrtimer timer;
+	struct fwdt_msr_sample *samples;
+	u32 head;
+	u32 tail;
+	u64 dropped;
+};
+
+static DEFINE_PER_CPU(struct fwdt_msr_ring, msr_rings);
+static DEFINE_MUTEX(fwdt_msr_sampler_lock);
+static DECLARE_WAIT_QUEUE_HEAD(msr_sample_wait);
+static cpumask_var_t msr_sampler_mask;
+static bool msr_sampler_running;
+static u32 msr_sampler_msrs[FWDT_MSR_SAMPLE_MAX];
+static u32 msr_sampler_num_msrs;
+static u32 msr_sampler_ring_size;
+static ktime_t msr_sampler_period;
+
+static enum hrtimer_restart fwdt_msr_sampler_tick(struct hrtimer *timer)
+{
+	struct fwdt_msr_ring *ring;
+	struct fwdt_msr_sample *s;
+	u32 head, i;
+
+	ring = container_of(timer, struct fwdt_msr_ring, timer);
+	head = ring->head;
+	if (head - smp_load_acquire(&ring->tail) >= msr_sampler_ring_size) {
+		ring->dropped++;
+		goto out;
+	}
+
+	s = &ring->samples[head & (msr_sampler_ring_size - 1)];
+	s->timestamp = ktime_get_ns();
+	s->cpu = smp_processor_id();
+	s->err_mask = 0;
+	for (i = 0; i < msr_sampler_num_msrs; i++) {
+		if (rdmsrl_safe(msr_sampler_msrs[i], &s->values[i]))
+			s->err_mask |= BIT(i);
+	}
+	smp_store_release(&ring->head, head + 1);
+
+	if (wq_has_sleeper(&msr_sample_wait))
+		wake_up_interruptible(&msr_sample_wait);
+
+out:
+	hrtimer_forward_now(timer, msr_sampler_period);
+	return HRTIMER_RESTART;
+}
+
+static void fwdt_msr_sampler_start_ipi(void *data)
+{
+	struct fwdt_msr_ring *ring = this_cpu_ptr(&msr_rings);
+
+	hrtimer_start(&ring->timer, msr_sampler_period,
+		      HRTIMER_MODE_REL_PINNED);
+}
+
+static void fwdt_msr_sampler_free(void)
+{
+	struct fwdt_msr_ring *ring;
+	unsigned int cpu;
+
+	for_each_cpu(cpu, msr_sampler_mask) {
+		ring = per_cpu_ptr(&msr_rings, cpu);
+		vfree(ring->samples);
+		ring->samples = NULL;
+	}
+	cpumask_clear(msr_sampler_mask);
+}
+
+/*
+ * Called with fwdt_msr_sampler_lock held. The rings are kept so that
+ * samples taken before the stop can still be read; they are freed on
+ * the next start or when the sample device is closed.
+ */
+static void fwdt_msr_sampler_stop(void)
+{
+	unsigned int cpu;
+
+	if (!msr_sampler_running)
+		return;
+
+	for_each_cpu(cpu, msr_sampler_mask)
+		hrtimer_cancel(&per_cpu_ptr(&msr_rings, cpu)->timer);
+
+	WRITE_ONCE(msr_sampler_running, false);
+	wake_up_interruptible(&msr_sample_wait);
+}
+
+/* Called with fwdt_msr_sampler_lock held */
+static int fwdt_msr_sampler_start(struct fwdt_msr_sampler *fms)
+{
+	struct fwdt_msr_ring *ring;
+	unsigned int cpu;
+	int ret;
+
+	if (msr_sampler_running)
+		return -EBUSY;
+
+	/* drop the rings of the previous run */
+	fwdt_msr_sampler_free();
+
+	if (fms->num_msrs == 0 || fms->num_msrs > FWDT_MSR_SAMPLE_MAX)
+		return -EINVAL;
+
+	if (fms->period_ns < FWDT_MSR_SAMPLER_MIN_PERIOD)
+		return -EINVAL;
+
+	if (fms->ring_size == 0)
+		fms->ring_size = FWDT_MSR_SAMPLER_RING_SIZE;
+	if (!is_power_of_2(fms->ring_size) ||
+	    fms->ring_size > FWDT_MSR_SAMPLER_RING_MAX)
+		return -EINVAL;
+
+	memcpy(msr_sampler_msrs, fms->msrs, sizeof(msr_sampler_msrs));
+	msr_sampler_num_msrs = fms->num_msrs;
+	msr_sampler_ring_size = fms->ring_size;
+	msr_sampler_period = ns_to_ktime(fms->period_ns);
+
+	cpus_read_lock();
+	ret = fwdt_msr_get_cpumask(msr_sampler_mask, fms->cpumask,
+				   fms->mask_size, nr_cpu_ids);
+	if (ret)
+		goto err;
+
+	for_each_cpu(cpu, msr_sampler_mask) {
+		ring = per_cpu_ptr(&msr_rings, cpu);
+		ring->samples = vzalloc_node(array_size(msr_sampler_ring_size,
+							sizeof(*ring->samples)),
+					     cpu_to_node(cpu));
+		if (!ring->samples) {
+			ret = -ENOMEM;
+			goto err;
+		}
+		ring->head = 0;
+		ring->tail = 0;
+		ring->dropped = 0;
+		hrtimer_init(&ring->timer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_REL_PINNED);
+		ring->timer.function = fwdt_msr_sampler_tick;
+	}
+
+	on_each_cpu_mask(msr_sampler_mask, fwdt_msr_sampler_start_ipi, NULL,
+			 true);
+	WRITE_ONCE(msr_sampler_running, true);
+	cpus_read_unlock();
+
+	return 0;
+
+err:
+	fwdt_msr_sampler_free();
+	cpus_read_unlock();
+	return ret;
+}
+
+int handle_msr_sampler_cmd(fwdt_generic __user *fg)
+{
+	int ret;
+	struct fwdt_msr_sampler fms;
+
+	if (unlikely(copy_from_user(&fms, fg, sizeof(struct fwdt_msr_sampler))))
+		return -EFAULT;
+
+	mutex_lock(&fwdt_msr_sampler_lock);
+	switch (fms.parameters.func) {
+	case START_MSR_SAMPLER:
+		ret = fwdt_msr_sampler_start(&fms);
+		break;
+	case STOP_MSR_SAMPLER:
+		fwdt_msr_sampler_stop();
+		ret = 0;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	mutex_unlock(&fwdt_msr_sampler_lock);
+
+	return ret;
+}
+
+static bool fwdt_msr_sample_pending(void)
+{
+	struct fwdt_msr_ring *ring;
+	unsigned int cpu;
+
+	for_each_cpu(cpu, msr_sampler_mask) {
+		ring = per_cpu_ptr(&msr_rings, cpu);
+		if (smp_load_acquire(&ring->head) != ring->tail)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Drain the rings of all sampled CPUs into whole fwdt_msr_sample records.
+ * Once the sampler is stopped and the rings are empty read returns 0.
+ */
+static ssize_t fwdt_msr_sample_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct fwdt_msr_ring *ring;
+	struct fwdt_msr_sample *s;
+	size_t copied = 0;
+	unsigned int cpu;
+	u32 head;
+	int err;
+
+	if (count < sizeof(struct fwdt_msr_sample))
+		return -EINVAL;
+
+	mutex_lock(&fwdt_msr_sampler_lock);
+	while (!fwdt_msr_sample_pending()) {
+		mutex_unlock(&fwdt_msr_sampler_lock);
+		if (!READ_ONCE(msr_sampler_running))
+			return 0;
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		err = wait_event_interruptible(msr_sample_wait,
+					       fwdt_msr_sample_pending() ||
+					       !READ_ONCE(msr_sampler_running));
+		if (err)
+			return err;
+		mutex_lock(&fwdt_msr_sampler_lock);
+	}
+
+	for_each_cpu(cpu, msr_sampler_mask) {
+		ring = per_cpu_ptr(&msr_rings, cpu);
+		head = smp_load_acquire(&ring->head);
+		while (ring->tail != head &&
+		       copied + sizeof(struct fwdt_msr_sample) <= count) {
+			s = &ring->samples[ring->tail &
+					   (msr_sampler_ring_size - 1)];
+			if (copy_to_user(buf + copied, s,
+					 sizeof(struct fwdt_msr_sample))) {
+				mutex_unlock(&fwdt_msr_sampler_lock);
+				return copied ? copied : -EFAULT;
+			}
+			copied += sizeof(struct fwdt_msr_sample);
+			smp_store_release(&ring->tail, ring->tail + 1);
+		}
+	}
+	mutex_unlock(&fwdt_msr_sampler_lock);
+
+	return copied;
+}
+
+static __poll_t fwdt_msr_sample_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &msr_sample_wait, wait);
+
+	return fwdt_msr_sample_pending() ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static int fwdt_msr_sample_release(struct inode *inode, struct file *file)
+{
+	mutex_lock(&fwdt_msr_sampler_lock);
+	if (!msr_sampler_running)
+		fwdt_msr_sampler_free();
+	mutex_unlock(&fwdt_msr_sampler_lock);
+
+	return 0;
+}
+
+/* Samples lost to full rings since the last start, summed over CPUs */
+static int fwdt_msr_dropped_get(void *data, u64 *val)
+{
+	unsigned int cpu;
+
+	*val = 0;
+	mutex_lock(&fwdt_msr_sampler_lock);
+	for_each_cpu(cpu, msr_sampler_mask)
+		*val += READ_ONCE(per_cpu_ptr(&msr_rings, cpu)->dropped);
+	mutex_unlock(&fwdt_msr_sampler_lock);
+
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(fwdt_msr_dropped_fops, fwdt_msr_dropped_get, NULL,
+			 "%llu\n");
+
+static const struct file_operations fwdt_msr_sample_fops = {
+    .owner = THIS_MODULE,
+    .release = fwdt_msr_sample_release,
+    .read = fwdt_msr_sample_read,
+    .poll = fwdt_msr_sample_poll,
+    .llseek = no_llseek,
+};
+
+static struct miscdevice fwdt_msr_sample_dev = {MISC_DYNAMIC_MINOR,
+						"fwdt_msr_samples",
+						&fwdt_msr_sample_fops};
+
+static bool msr_sampler_registered;
+
+void fwdt_msr_sampler_init(void)
+{
+	if (!zalloc_cpumask_var(&msr_sampler_mask, GFP_KERNEL))
+		return;
+
+	if (misc_register(&fwdt_msr_sample_dev)) {
+		pr_info("Failed to register MSR sample device\n");
+		free_cpumask_var(msr_sampler_mask);
+		return;
+	}
+
+	msr_sampler_registered = true;
+	debugfs_create_file_unsafe("msr_samples_dropped", 0444,
+				   fwdt_debugfs_dir, NULL,
+				   &fwdt_msr_dropped_fops);
+}
+
+void fwdt_msr_sampler_exit(void)
+{
+	if (!msr_sampler_registered)
+		return;
+
+	misc_deregister(&fwdt_msr_sample_dev);
+
+	mutex_lock(&fwdt_msr_sampler_lock);
+	fwdt_msr_sampler_stop();
+	fwdt_msr_sampler_free();
+	mutex_unlock(&fwdt_msr_sampler_lock);
+
+	free_cpumask_var(msr_sampler_mask);
+}
+
+#endif
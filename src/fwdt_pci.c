@@ -17,50 +17,1073 @@
 #define pr_fmt(fmt) "fwdt: " fmt
 
 #include "fwdt_lib.h"
+#include <linux/acpi.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/io-64-nonatomic-lo-hi.h>
+#include <linux/io.h>
+#include <linux/ioport.h>
+#include <linux/iopoll.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/pci.h>
-#include <linux/semaphore.h>
+#include <linux/rwsem.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
 
 #ifdef CONFIG_PCI
 
-Pci_dev pci_dev;
+/* bound on capability list walks, as in the PCI core */
+#define FWDT_PCI_CAP_TTL 48
+
+/* larger BARs are only mapped up to this size */
+#define FWDT_PCI_BAR_MAP_MAX (256 * 1024 * 1024)
+#define FWDT_PCI_BAR_CHUNK (64 * 1024)
+
+/* delay between POLL_BAR reads, in microseconds */
+#define FWDT_PCI_BAR_POLL_SLEEP 10
+
+/*
+ * BAR mapping cached in the context of one open of /dev/fwdt. Every map is
+ * also on fwdt_bar_maps so that it can be unmapped when its device is
+ * removed; virt is only dereferenced with fwdt_bar_sem held for read.
+ * users counts the ioctls working on the map and is protected by ctx->lock.
+ */
+struct fwdt_bar_map {
+	struct list_head node;
+	struct list_head all;
+	struct pci_dev *pdev;
+	int bar;
+	int users;
+	bool removed;
+	void __iomem *virt;
+	u64 size;
+};
+
+static LIST_HEAD(fwdt_bar_maps);
+static DECLARE_RWSEM(fwdt_bar_sem);
+
+static Pci_dev pci_dev;
+static DEFINE_MUTEX(fwdt_pci_lock);
+
+/* last device resolved by segment:bus:devfn, holds a reference */
+static struct pci_dev *fwdt_pci_last;
+
+/*
+ * Return a referenced pci_dev for segment:bus:devfn. The last device looked
+ * up stays cached so that repeated accesses to one function skip the walk
+ * of the PCI device list.
+ */
+struct pci_dev *fwdt_pci_get_dev(u16 segment, u8 bus, u8 devfn)
+{
+	struct pci_dev *pdev;
+
+	mutex_lock(&fwdt_pci_lock);
+	pdev = fwdt_pci_last;
+	if (!pdev || pci_domain_nr(pdev->bus) != segment ||
+	    pdev->bus->number != bus || pdev->devfn != devfn) {
+		pdev = pci_get_domain_bus_and_slot(segment, bus, devfn);
+		if (!pdev) {
+			mutex_unlock(&fwdt_pci_lock);
+			return NULL;
+		}
+		pci_dev_put(fwdt_pci_last);
+		fwdt_pci_last = pdev;
+	}
+	pci_dev_get(pdev);
+	mutex_unlock(&fwdt_pci_lock);
+
+	return pdev;
+}
+
+static atomic64_t pci_ecam_accesses = ATOMIC64_INIT(0);
+static atomic64_t pci_conf_accesses = ATOMIC64_INIT(0);
+
+static int fwdt_pci_count_get(void *data, u64 *val)
+{
+	*val = atomic64_read(data);
+
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(fwdt_pci_count_fops, fwdt_pci_count_get, NULL,
+			 "%llu\n");
+
+#ifdef CONFIG_ACPI
+/* One MCFG allocation, buses are mapped 1 MiB at a time on first use */
+struct fwdt_ecam_region {
+	u64 address;
+	u16 segment;
+	u8 start_bus;
+	u8 end_bus;
+	void __iomem **bus_map;
+};
+
+static struct fwdt_ecam_region *ecam_regions;
+static int ecam_num_regions;
+static DEFINE_MUTEX(fwdt_ecam_lock);
+
+static void fwdt_pci_ecam_init(void)
+{
+	struct acpi_mcfg_allocation *cfg;
+	struct acpi_table_header *hdr;
+	struct fwdt_ecam_region *r;
+	u64 start, size;
+	int i, n;
+
+	if (ACPI_FAILURE(acpi_get_table(ACPI_SIG_MCFG, 0, &hdr)))
+		return;
+
+	if (hdr->length < sizeof(struct acpi_table_mcfg))
+		goto out;
+
+	n = (hdr->length - sizeof(struct acpi_table_mcfg)) /
+	    sizeof(struct acpi_mcfg_allocation);
+	if (n == 0)
+		goto out;
+
+	ecam_regions = kcalloc(n, sizeof(struct fwdt_ecam_region), GFP_KERNEL);
+	if (!ecam_regions)
+		goto out;
+
+	cfg = (struct acpi_mcfg_allocation *)((struct acpi_table_mcfg *)hdr +
+					      1);
+	for (i = 0; i < n; i++, cfg++) {
+		if (cfg->end_bus_number < cfg->start_bus_number)
+			continue;
+
+		/* the kernel may have rejected this MCFG, check it ourselves */
+		start = cfg->address + ((u64)cfg->start_bus_number << 20);
+		size = (u64)(cfg->end_bus_number - cfg->start_bus_number + 1)
+		       << 20;
+		if (region_intersects(start, size, IORESOURCE_SYSTEM_RAM,
+				      IORES_DESC_NONE) != REGION_DISJOINT) {
+			pr_info("MCFG region %llx-%llx overlaps RAM, ignored\n",
+				start, start + size - 1);
+			continue;
+		}
+
+		r = &ecam_regions[ecam_num_regions];
+		r->bus_map = kcalloc(cfg->end_bus_number -
+					 cfg->start_bus_number + 1,
+				     sizeof(void __iomem *), GFP_KERNEL);
+		if (!r->bus_map)
+			break;
+
+		r->address = cfg->address;
+		r->segment = cfg->pci_segment;
+		r->start_bus = cfg->start_bus_number;
+		r->end_bus = cfg->end_bus_number;
+		ecam_num_regions++;
+	}
+
+out:
+	acpi_put_table(hdr);
+}
+
+static void fwdt_pci_ecam_exit(void)
+{
+	struct fwdt_ecam_region *r;
+	int i, bus;
+
+	for (i = 0; i < ecam_num_regions; i++) {
+		r = &ecam_regions[i];
+		for (bus = 0; bus <= r->end_bus - r->start_bus; bus++) {
+			if (r->bus_map[bus])
+				iounmap(r->bus_map[bus]);
+		}
+		kfree(r->bus_map);
+	}
+
+	kfree(ecam_regions);
+	ecam_regions = NULL;
+	ecam_num_regions = 0;
+}
+
+/*
+ * Return the ECAM window of pdev, or NULL when it is not covered by MCFG
+ * or does not answer there, in which case the caller falls back to the
+ * kernel's config accessors for this device.
+ */
+static void __iomem *fwdt_pci_ecam_base(struct pci_dev *pdev)
+{
+	u16 segment = pci_domain_nr(pdev->bus);
+	u8 bus = pdev->bus->number;
+	void __iomem *base = NULL;
+	void __iomem **map;
+	int i;
+
+	mutex_lock(&fwdt_ecam_lock);
+	for (i = 0; i < ecam_num_regions; i++) {
+		if (ecam_regions[i].segment != segment ||
+		    bus < ecam_regions[i].start_bus ||
+		    bus > ecam_regions[i].end_bus)
+			continue;
+
+		map = &ecam_regions[i].bus_map[bus - ecam_regions[i].start_bus];
+		if (!*map)
+			*map = ioremap(ecam_regions[i].address +
+					   ((u64)bus << 20),
+				       1 << 20);
+		base = *map;
+		break;
+	}
+	mutex_unlock(&fwdt_ecam_lock);
+
+	if (!base)
+		return NULL;
+
+	base += pdev->devfn << 12;
+	if ((readl(base + PCI_VENDOR_ID) & 0xFFFF) != pdev->vendor)
+		return NULL;
+
+	return base;
+}
+#endif
+
+/*
+ * Drop cached references to devices that are going away and unmap their
+ * BARs, which may be reassigned to another device after removal.
+ */
+static int fwdt_pci_notify(struct notifier_block *nb, unsigned long action,
+			   void *data)
+{
+	struct pci_dev *pdev = to_pci_dev(data);
+	struct fwdt_bar_map *map;
+
+	if (action != BUS_NOTIFY_DEL_DEVICE)
+		return NOTIFY_DONE;
+
+	mutex_lock(&fwdt_pci_lock);
+	if (fwdt_pci_last == pdev) {
+		pci_dev_put(fwdt_pci_last);
+		fwdt_pci_last = NULL;
+	}
+	if (pci_dev.pdev == pdev) {
+		pci_dev_put(pci_dev.pdev);
+		pci_dev.pdev = NULL;
+	}
+	mutex_unlock(&fwdt_pci_lock);
+
+	down_write(&fwdt_bar_sem);
+	list_for_each_entry(map, &fwdt_bar_maps, all) {
+		if (map->pdev == pdev && !map->removed) {
+			pci_iounmap(pdev, map->virt);
+			map->virt = NULL;
+			map->removed = true;
+		}
+	}
+	up_write(&fwdt_bar_sem);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block fwdt_pci_nb = {
+	.notifier_call = fwdt_pci_notify,
+};
+
+void fwdt_pci_init(void)
+{
+	pci_dev.vid = 0xFFFF;
+	pci_dev.did = 0xFFFF;
+	pci_dev.offset = 0xFF;
+	pci_dev.pdev = NULL;
+
+	bus_register_notifier(&pci_bus_type, &fwdt_pci_nb);
+
+#ifdef CONFIG_ACPI
+	fwdt_pci_ecam_init();
+#endif
+	debugfs_create_file_unsafe("pci_ecam_accesses", 0444, fwdt_debugfs_dir,
+				   &pci_ecam_accesses, &fwdt_pci_count_fops);
+	debugfs_create_file_unsafe("pci_conf_accesses", 0444, fwdt_debugfs_dir,
+				   &pci_conf_accesses, &fwdt_pci_count_fops);
+}
+
+void fwdt_pci_exit(void)
+{
+	bus_unregister_notifier(&pci_bus_type, &fwdt_pci_nb);
+
+	pci_dev_put(fwdt_pci_last);
+	fwdt_pci_last = NULL;
+	pci_dev_put(pci_dev.pdev);
+	pci_dev.pdev = NULL;
+
+#ifdef CONFIG_ACPI
+	fwdt_pci_ecam_exit();
+#endif
+}
 
 ssize_t pci_read_data(struct device *dev, struct device_attribute *attr,
 		      char *buf)
 {
-	struct pci_dev *pdev = NULL;
 	int data;
 
-	pdev = pci_get_device(pci_dev.vid, pci_dev.did, NULL);
-	if (pdev == NULL) {
-		pr_info("pci device [%04x:%04x] is not found\n", pci_dev.vid,
-			pci_dev.did);
-		return -EINVAL;
+	mutex_lock(&fwdt_pci_lock);
+	if (pci_dev.pdev == NULL) {
+		pr_info("pci device is not selected\n");
+		mutex_unlock(&fwdt_pci_lock);
+		return -ENODEV;
 	}
 
-	pci_read_config_dword(pdev, pci_dev.offset, &data);
+	pci_read_config_dword(pci_dev.pdev, pci_dev.offset, &data);
+	mutex_unlock(&fwdt_pci_lock);
 
 	return sprintf(buf, "0x%08x\n", data);
-	;
 }
 
 ssize_t pci_write_data(struct device *dev, struct device_attribute *attr,
 		       const char *buf, size_t count)
 {
-	struct pci_dev *pdev = NULL;
 	int data;
 
 	data = simple_strtoul(buf, NULL, 16) & 0xFFFFFFFF;
-	pdev = pci_get_device(pci_dev.vid, pci_dev.did, NULL);
-	if (pdev)
-		pci_write_config_dword(pdev, pci_dev.offset, data);
+	mutex_lock(&fwdt_pci_lock);
+	if (pci_dev.pdev)
+		pci_write_config_dword(pci_dev.pdev, pci_dev.offset, data);
 	else
-		pr_info("pci device [%04x:%04x] is not found\n", pci_dev.vid,
-			pci_dev.did);
+		pr_info("pci device is not selected\n");
+	mutex_unlock(&fwdt_pci_lock);
 
 	return count;
 }
 
+static int fwdt_pci_access_dev(struct pci_dev *pdev, u16 func, int where,
+			       u32 *data)
+{
+	int ret;
+	u8 byte;
+	u16 word;
+
+	switch (func) {
+	case GET_DATA_BYTE:
+		ret = pci_read_config_byte(pdev, where, &byte);
+		*data = byte;
+		break;
+	case SET_DATA_BYTE:
+		ret = pci_write_config_byte(pdev, where, *data);
+		break;
+	case GET_DATA_WORD:
+		ret = pci_read_config_word(pdev, where, &word);
+		*data = word;
+		break;
+	case SET_DATA_WORD:
+		ret = pci_write_config_word(pdev, where, *data);
+		break;
+	case GET_DATA_DWORD:
+		ret = pci_read_config_dword(pdev, where, data);
+		break;
+	case SET_DATA_DWORD:
+		ret = pci_write_config_dword(pdev, where, *data);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret > 0 ? pcibios_err_to_errno(ret) : ret;
+}
+
+int fwdt_pci_access(u16 func, u64 address, u32 *data)
+{
+	struct pci_dev *pdev;
+	int ret;
+
+	pdev = fwdt_pci_get_dev(address >> 32, (address >> 20) & 0xFF,
+				(address >> 12) & 0xFF);
+	if (!pdev)
+		return -ENODEV;
+
+	ret = fwdt_pci_access_dev(pdev, func, address & 0xFFF, data);
+	pci_dev_put(pdev);
+
+	return ret;
+}
+
+static int fwdt_pci_conf_copy(struct pci_dev *pdev, int where, void *buf,
+			      int len, u32 width, bool write)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < len && !ret; i += width) {
+		switch (width) {
+		case 1:
+			if (write)
+				ret = pci_write_config_byte(pdev, where + i,
+							    *(u8 *)(buf + i));
+			else
+				ret = pci_read_config_byte(pdev, where + i,
+							   buf + i);
+			break;
+		case 2:
+			if (write)
+				ret = pci_write_config_word(pdev, where + i,
+							    *(u16 *)(buf + i));
+			else
+				ret = pci_read_config_word(pdev, where + i,
+							   buf + i);
+			break;
+		case 4:
+			if (write)
+				ret = pci_write_config_dword(pdev, where + i,
+							     *(u32 *)(buf + i));
+			else
+				ret = pci_read_config_dword(pdev, where + i,
+							    buf + i);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	return ret > 0 ? pcibios_err_to_errno(ret) : ret;
+}
+
+#ifdef CONFIG_ACPI
+static int fwdt_pci_ecam_read(void __iomem *base, int where, void *buf,
+			      int len, u32 width)
+{
+	int i;
+
+	for (i = 0; i < len; i += width) {
+		switch (width) {
+		case 1:
+			*(u8 *)(buf + i) = readb(base + where + i);
+			break;
+		case 2:
+			*(u16 *)(buf + i) = readw(base + where + i);
+			break;
+		case 4:
+			*(u32 *)(buf + i) = readl(base + where + i);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+/*
+ * Copy len bytes of config space at where, one width-sized access at a
+ * time. With FWDT_PCI_ECAM reads are plain MMIO loads through the MCFG
+ * window when the function is reachable there. Writes always go through
+ * the PCI core so that they honour pci_lock and pci_cfg_access_lock().
+ */
+int fwdt_pci_config_copy(struct pci_dev *pdev, int where, void *buf, int len,
+			 u32 width, u32 flags, bool write)
+{
+#ifdef CONFIG_ACPI
+	void __iomem *base;
+
+	if ((flags & FWDT_PCI_ECAM) && !write) {
+		base = fwdt_pci_ecam_base(pdev);
+		if (base) {
+			atomic64_add(len / width, &pci_ecam_accesses);
+			return fwdt_pci_ecam_read(base, where, buf, len, width);
+		}
+	}
+#endif
+
+	atomic64_add(len / width, &pci_conf_accesses);
+	return fwdt_pci_conf_copy(pdev, where, buf, len, width, write);
+}
+
+int handle_pci_config_cmd(fwdt_generic __user *fg)
+{
+	struct fwdt_pci_config fpc;
+	struct pci_dev *pdev;
+	void __user *ubuf;
+	void *buf;
+	bool write;
+	int ret;
+
+	if (unlikely(copy_from_user(&fpc, fg, sizeof(struct fwdt_pci_config))))
+		return -EFAULT;
+
+	switch (fpc.parameters.func) {
+	case GET_DATA_BLOCK:
+		write = false;
+		break;
+	case SET_DATA_BLOCK:
+		write = true;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (fpc.width != 1 && fpc.width != 2 && fpc.width != 4)
+		return -EINVAL;
+
+	if (fpc.length == 0 || fpc.length > FWDT_PCI_CONFIG_MAX ||
+	    !IS_ALIGNED(fpc.offset | fpc.length, fpc.width))
+		return -EINVAL;
+
+	pdev = fwdt_pci_get_dev(fpc.segment, fpc.bus, fpc.devfn);
+	if (!pdev)
+		return -ENODEV;
+
+	if (fpc.offset + fpc.length > pdev->cfg_size) {
+		ret = -EINVAL;
+		goto out_put;
+	}
+
+	ubuf = u64_to_user_ptr(fpc.buffer);
+	if (write) {
+		buf = memdup_user(ubuf, fpc.length);
+		if (IS_ERR(buf)) {
+			ret = PTR_ERR(buf);
+			goto out_put;
+		}
+	} else {
+		buf = kmalloc(fpc.length, GFP_KERNEL);
+		if (!buf) {
+			ret = -ENOMEM;
+			goto out_put;
+		}
+	}
+
+	ret = fwdt_pci_config_copy(pdev, fpc.offset, buf, fpc.length,
+				   fpc.width, fpc.flags, write);
+	if (!ret && !write && copy_to_user(ubuf, buf, fpc.length))
+		ret = -EFAULT;
+
+	kfree(buf);
+out_put:
+	pci_dev_put(pdev);
+	return ret;
+}
+
+int handle_pci_inventory_cmd(fwdt_generic __user *fg)
+{
+	struct fwdt_pci_inventory fpi;
+	struct fwdt_pci_record rec;
+	struct pci_dev *pdev = NULL;
+	void __user *ubuf;
+	u64 used = 0;
+	void *buf;
+	int ret = 0;
+
+	if (unlikely(copy_from_user(&fpi, fg,
+				    sizeof(struct fwdt_pci_inventory))))
+		return -EFAULT;
+
+	if (fpi.config_size != 64 && fpi.config_size != 256 &&
+	    fpi.config_size != FWDT_PCI_CONFIG_MAX)
+		return -EINVAL;
+
+	buf = kmalloc(fpi.config_size, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	ubuf = u64_to_user_ptr(fpi.buffer);
+	fpi.num_devices = 0;
+	for_each_pci_dev(pdev) {
+		rec.segment = pci_domain_nr(pdev->bus);
+		rec.bus = pdev->bus->number;
+		rec.devfn = pdev->devfn;
+		rec.config_size = min_t(int, fpi.config_size,
+					pdev->cfg_size);
+		rec.reserved = 0;
+
+		fpi.num_devices++;
+		used += sizeof(rec) + rec.config_size;
+
+		/* keep walking to report the size needed */
+		if (ret || used > fpi.length) {
+			ret = -ENOSPC;
+			continue;
+		}
+
+		if (fwdt_pci_config_copy(pdev, 0, buf, rec.config_size, 4,
+					 fpi.flags, false))
+			memset(buf, 0xFF, rec.config_size);
+
+		if (copy_to_user(ubuf, &rec, sizeof(rec)) ||
+		    copy_to_user(ubuf + sizeof(rec), buf, rec.config_size)) {
+			pci_dev_put(pdev);
+			kfree(buf);
+			return -EFAULT;
+		}
+		ubuf += sizeof(rec) + rec.config_size;
+
+		if (signal_pending(current)) {
+			pci_dev_put(pdev);
+			kfree(buf);
+			return -EINTR;
+		}
+	}
+
+	kfree(buf);
+
+	fpi.length = used;
+	if (unlikely(copy_to_user(fg, &fpi,
+				  sizeof(struct fwdt_pci_inventory))))
+		return -EFAULT;
+
+	return ret;
+}
+
+/* Walk the standard and then the extended capability lists of pdev */
+static u32 fwdt_pci_cap_list(struct pci_dev *pdev,
+			     struct fwdt_pci_cap_entry *caps, u32 max)
+{
+	int ttl = FWDT_PCI_CAP_TTL;
+	u32 n = 0, header;
+	u8 pos, id;
+	u16 status;
+	int epos;
+
+	pci_read_config_word(pdev, PCI_STATUS, &status);
+	if (status & PCI_STATUS_CAP_LIST) {
+		if (pdev->hdr_type == PCI_HEADER_TYPE_CARDBUS)
+			pci_read_config_byte(pdev, PCI_CB_CAPABILITY_LIST,
+					     &pos);
+		else
+			pci_read_config_byte(pdev, PCI_CAPABILITY_LIST, &pos);
+
+		while (ttl-- && pos >= 0x40 && n < max) {
+			pos &= ~3;
+			pci_read_config_byte(pdev, pos + PCI_CAP_LIST_ID, &id);
+			if (id == 0xFF)
+				break;
+
+			caps[n].cap_id = id;
+			caps[n].flags = 0;
+			caps[n].version = 0;
+			caps[n].offset = pos;
+			caps[n].reserved = 0;
+			n++;
+
+			pci_read_config_byte(pdev, pos + PCI_CAP_LIST_NEXT,
+					     &pos);
+		}
+	}
+
+	if (pdev->cfg_size <= PCI_CFG_SPACE_SIZE)
+		return n;
+
+	ttl = (PCI_CFG_SPACE_EXP_SIZE - PCI_CFG_SPACE_SIZE) / 8;
+	epos = PCI_CFG_SPACE_SIZE;
+	while (ttl-- && epos >= PCI_CFG_SPACE_SIZE && n < max) {
+		if (pci_read_config_dword(pdev, epos, &header) || !header ||
+		    header == 0xFFFFFFFF)
+			break;
+
+		caps[n].cap_id = PCI_EXT_CAP_ID(header);
+		caps[n].flags = FWDT_PCI_CAP_EXTENDED;
+		caps[n].version = PCI_EXT_CAP_VER(header);
+		caps[n].offset = epos;
+		caps[n].reserved = 0;
+		n++;
+
+		epos = PCI_EXT_CAP_NEXT(header);
+	}
+
+	return n;
+}
+
+static int fwdt_pci_cap_field(struct fwdt_pci_cap_access *fca, bool write)
+{
+	struct pci_dev *pdev;
+	u16 func;
+	int pos, ret;
+
+	switch (fca->width) {
+	case 1:
+		func = write ? SET_DATA_BYTE : GET_DATA_BYTE;
+		break;
+	case 2:
+		func = write ? SET_DATA_WORD : GET_DATA_WORD;
+		break;
+	case 4:
+		func = write ? SET_DATA_DWORD : GET_DATA_DWORD;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!IS_ALIGNED(fca->offset, fca->width))
+		return -EINVAL;
+
+	pdev = fwdt_pci_get_dev(fca->segment, fca->bus, fca->devfn);
+	if (!pdev)
+		return -ENODEV;
+
+	if (fca->flags & FWDT_PCI_CAP_EXTENDED)
+		pos = pci_find_ext_capability(pdev, fca->cap_id);
+	else
+		pos = pci_find_capability(pdev, fca->cap_id);
+
+	if (!pos)
+		ret = -ENOENT;
+	else if (pos + fca->offset + fca->width > pdev->cfg_size)
+		ret = -EINVAL;
+	else
+		ret = fwdt_pci_access_dev(pdev, func, pos + fca->offset,
+					  &fca->data);
+
+	pci_dev_put(pdev);
+
+	return ret;
+}
+
+int handle_pci_cap_cmd(fwdt_generic __user *fg)
+{
+	struct fwdt_pci_cap_data fpc;
+	struct fwdt_pci_cap_entry *caps;
+	struct fwdt_pci_cap_access *fca;
+	struct pci_dev *pdev;
+	void __user *ubuf;
+	int ret = 0;
+	u32 i;
+
+	if (unlikely(copy_from_user(&fpc, fg,
+				    sizeof(struct fwdt_pci_cap_data))))
+		return -EFAULT;
+
+	if (fpc.count == 0 || fpc.count > FWDT_PCI_CAP_MAX)
+		return -EINVAL;
+
+	ubuf = u64_to_user_ptr(fpc.buffer);
+
+	switch (fpc.parameters.func) {
+	case GET_CAP_LIST:
+		pdev = fwdt_pci_get_dev(fpc.segment, fpc.bus, fpc.devfn);
+		if (!pdev)
+			return -ENODEV;
+
+		caps = kcalloc(fpc.count, sizeof(struct fwdt_pci_cap_entry),
+			       GFP_KERNEL);
+		if (!caps) {
+			pci_dev_put(pdev);
+			return -ENOMEM;
+		}
+
+		fpc.count = fwdt_pci_cap_list(pdev, caps, fpc.count);
+		pci_dev_put(pdev);
+
+		if (copy_to_user(ubuf, caps,
+				 fpc.count * sizeof(struct fwdt_pci_cap_entry)))
+			ret = -EFAULT;
+		kfree(caps);
+		break;
+	case GET_CAP_FIELD:
+	case SET_CAP_FIELD:
+		fca = memdup_user(ubuf,
+				  fpc.count * sizeof(struct fwdt_pci_cap_access));
+		if (IS_ERR(fca))
+			return PTR_ERR(fca);
+
+		for (i = 0; i < fpc.count; i++)
+			fca[i].status = fwdt_pci_cap_field(
+			    &fca[i], fpc.parameters.func == SET_CAP_FIELD);
+
+		if (copy_to_user(ubuf, fca,
+				 fpc.count * sizeof(struct fwdt_pci_cap_access)))
+			ret = -EFAULT;
+		kfree(fca);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!ret && unlikely(copy_to_user(fg, &fpc,
+					  sizeof(struct fwdt_pci_cap_data))))
+		ret = -EFAULT;
+
+	return ret;
+}
+
+/* Called with ctx->lock held, or on release */
+static void fwdt_pci_bar_free(struct fwdt_bar_map *map)
+{
+	list_del(&map->node);
+	down_write(&fwdt_bar_sem);
+	list_del(&map->all);
+	if (!map->removed)
+		pci_iounmap(map->pdev, map->virt);
+	up_write(&fwdt_bar_sem);
+	pci_dev_put(map->pdev);
+	kfree(map);
+}
+
+/*
+ * Called with ctx->lock held. Maps of removed devices that are no longer
+ * in use are freed on the way, so hotplug cycles do not pile them up.
+ */
+static struct fwdt_bar_map *fwdt_pci_bar_map(struct fwdt_context *ctx,
+					     struct fwdt_pci_bar *fpb)
+{
+	struct fwdt_bar_map *map, *tmp;
+	struct pci_dev *pdev;
+	u64 size;
+
+	list_for_each_entry_safe(map, tmp, &ctx->bar_maps, node) {
+		if (READ_ONCE(map->removed)) {
+			if (!map->users)
+				fwdt_pci_bar_free(map);
+			continue;
+		}
+
+		if (pci_domain_nr(map->pdev->bus) == fpb->segment &&
+		    map->pdev->bus->number == fpb->bus &&
+		    map->pdev->devfn == fpb->devfn && map->bar == fpb->bar)
+			return map;
+	}
+
+	if (fpb->bar >= PCI_ROM_RESOURCE)
+		return ERR_PTR(-EINVAL);
+
+	pdev = fwdt_pci_get_dev(fpb->segment, fpb->bus, fpb->devfn);
+	if (!pdev)
+		return ERR_PTR(-ENODEV);
+
+	size = min_t(u64, pci_resource_len(pdev, fpb->bar),
+		     FWDT_PCI_BAR_MAP_MAX);
+	if (!size || !(pci_resource_flags(pdev, fpb->bar) &
+		       (IORESOURCE_MEM | IORESOURCE_IO))) {
+		pci_dev_put(pdev);
+		return ERR_PTR(-ENXIO);
+	}
+
+	map = kzalloc(sizeof(struct fwdt_bar_map), GFP_KERNEL);
+	if (!map) {
+		pci_dev_put(pdev);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	map->virt = pci_iomap(pdev, fpb->bar, size);
+	if (!map->virt) {
+		kfree(map);
+		pci_dev_put(pdev);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	map->pdev = pdev;
+	map->bar = fpb->bar;
+	map->size = size;
+	list_add(&map->node, &ctx->bar_maps);
+
+	down_write(&fwdt_bar_sem);
+	list_add(&map->all, &fwdt_bar_maps);
+	up_write(&fwdt_bar_sem);
+
+	return map;
+}
+
+static u64 fwdt_pci_bar_read(void __iomem *addr, u32 width)
+{
+	switch (width) {
+	case 1:
+		return ioread8(addr);
+	case 2:
+		return ioread16(addr);
+	case 4:
+		return ioread32(addr);
+	default:
+		return ioread64(addr);
+	}
+}
+
+/* ioread/iowrite so that I/O port BARs work as well as memory BARs */
+static void fwdt_pci_bar_read_io(void *dst, void __iomem *src, size_t len,
+				 u32 width)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += width) {
+		switch (width) {
+		case 1:
+			*(u8 *)(dst + i) = ioread8(src + i);
+			break;
+		case 2:
+			*(u16 *)(dst + i) = ioread16(src + i);
+			break;
+		case 4:
+			*(u32 *)(dst + i) = ioread32(src + i);
+			break;
+		default:
+			*(u64 *)(dst + i) = ioread64(src + i);
+			break;
+		}
+	}
+}
+
+static void fwdt_pci_bar_write_io(void __iomem *dst, const void *src,
+				  size_t len, u32 width)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += width) {
+		switch (width) {
+		case 1:
+			iowrite8(*(u8 *)(src + i), dst + i);
+			break;
+		case 2:
+			iowrite16(*(u16 *)(src + i), dst + i);
+			break;
+		case 4:
+			iowrite32(*(u32 *)(src + i), dst + i);
+			break;
+		default:
+			iowrite64(*(u64 *)(src + i), dst + i);
+			break;
+		}
+	}
+}
+
+static int fwdt_pci_bar_copy(struct fwdt_pci_bar *fpb,
+			     struct fwdt_bar_map *map, bool write)
+{
+	void __user *ubuf = u64_to_user_ptr(fpb->buffer);
+	size_t done, chunk;
+	void *bounce;
+	int ret = 0;
+
+	bounce = kmalloc(FWDT_PCI_BAR_CHUNK, GFP_KERNEL);
+	if (!bounce)
+		return -ENOMEM;
+
+	for (done = 0; done < fpb->length; done += chunk) {
+		chunk = min_t(size_t, fpb->length - done, FWDT_PCI_BAR_CHUNK);
+
+		if (write && copy_from_user(bounce, ubuf + done, chunk)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		down_read(&fwdt_bar_sem);
+		if (map->removed) {
+			up_read(&fwdt_bar_sem);
+			ret = -ENODEV;
+			break;
+		}
+		if (write)
+			fwdt_pci_bar_write_io(map->virt + fpb->offset + done,
+					      bounce, chunk, fpb->width);
+		else
+			fwdt_pci_bar_read_io(bounce,
+					     map->virt + fpb->offset + done,
+					     chunk, fpb->width);
+		up_read(&fwdt_bar_sem);
+
+		if (!write && copy_to_user(ubuf + done, bounce, chunk)) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	kfree(bounce);
+	return ret;
+}
+
+static u64 fwdt_pci_bar_poll_read(struct fwdt_bar_map *map, u64 offset,
+				  u32 width)
+{
+	u64 data = ~0ULL;
+
+	down_read(&fwdt_bar_sem);
+	if (!map->removed)
+		data = fwdt_pci_bar_read(map->virt + offset, width);
+	up_read(&fwdt_bar_sem);
+
+	return data;
+}
+
+static int fwdt_pci_bar_poll(struct fwdt_pci_bar *fpb,
+			     struct fwdt_bar_map *map)
+{
+	int ret;
+
+	ret = read_poll_timeout(fwdt_pci_bar_poll_read, fpb->data,
+				(fpb->data & fpb->mask) == fpb->value ||
+					READ_ONCE(map->removed),
+				FWDT_PCI_BAR_POLL_SLEEP, fpb->timeout_us, false,
+				map, fpb->offset, fpb->width);
+
+	return READ_ONCE(map->removed) ? -ENODEV : ret;
+}
+
+int handle_pci_bar_cmd(struct fwdt_context *ctx, fwdt_generic __user *fg)
+{
+	struct fwdt_pci_bar fpb;
+	struct fwdt_bar_map *map;
+	u64 length;
+	int ret;
+
+	if (unlikely(copy_from_user(&fpb, fg, sizeof(struct fwdt_pci_bar))))
+		return -EFAULT;
+
+	if (fpb.width != 1 && fpb.width != 2 && fpb.width != 4 &&
+	    fpb.width != 8)
+		return -EINVAL;
+
+	switch (fpb.parameters.func) {
+	case READ_BAR:
+	case WRITE_BAR:
+		if (fpb.length == 0 || fpb.length > FWDT_PCI_BAR_MAX)
+			return -EINVAL;
+		length = fpb.length;
+		break;
+	case POLL_BAR:
+		if (fpb.timeout_us > FWDT_PCI_BAR_POLL_MAX)
+			return -EINVAL;
+		length = fpb.width;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!IS_ALIGNED(fpb.offset | length, fpb.width))
+		return -EINVAL;
+
+	mutex_lock(&ctx->lock);
+	map = fwdt_pci_bar_map(ctx, &fpb);
+	if (!IS_ERR(map) &&
+	    (fpb.offset >= map->size || length > map->size - fpb.offset))
+		map = ERR_PTR(-EINVAL);
+	/* a map in use is not freed, so it stays valid after unlock */
+	if (!IS_ERR(map))
+		map->users++;
+	mutex_unlock(&ctx->lock);
+
+	if (IS_ERR(map))
+		return PTR_ERR(map);
+
+	switch (fpb.parameters.func) {
+	case READ_BAR:
+		ret = fwdt_pci_bar_copy(&fpb, map, false);
+		break;
+	case WRITE_BAR:
+		ret = fwdt_pci_bar_copy(&fpb, map, true);
+		break;
+	default:
+		ret = fwdt_pci_bar_poll(&fpb, map);
+		if ((!ret || ret == -ETIMEDOUT) &&
+		    unlikely(copy_to_user(fg, &fpb,
+					  sizeof(struct fwdt_pci_bar))))
+			ret = -EFAULT;
+		break;
+	}
+
+	mutex_lock(&ctx->lock);
+	map->users--;
+	mutex_unlock(&ctx->lock);
+
+	return ret;
+}
+
+void fwdt_pci_release(struct fwdt_context *ctx)
+{
+	struct fwdt_bar_map *map, *tmp;
+
+	list_for_each_entry_safe(map, tmp, &ctx->bar_maps, node)
+		fwdt_pci_bar_free(map);
+}
+
 ssize_t pci_read_offset(struct device *dev, struct device_attribute *attr,
 			char *buf)
 {
@@ -70,33 +1093,72 @@ ssize_t pci_read_offset(struct device *dev, struct device_attribute *attr,
 ssize_t pci_write_offset(struct device *dev, struct device_attribute *attr,
 			 const char *buf, size_t count)
 {
+	mutex_lock(&fwdt_pci_lock);
 	pci_dev.offset = simple_strtoul(buf, NULL, 16) & 0xFF;
+	mutex_unlock(&fwdt_pci_lock);
 	return count;
 }
 
 ssize_t pci_read_ids(struct device *dev, struct device_attribute *attr,
 		     char *buf)
 {
-	if (pci_dev.vid == 0xFFFF || pci_dev.did == 0xFFFF)
-		strcpy(buf, "ex. 8086:1c2d\n");
+	mutex_lock(&fwdt_pci_lock);
+	if (pci_dev.pdev == NULL)
+		strcpy(buf, "ex. 8086:1c2d or 0000:00:1f.3\n");
+	else if (pci_dev.vid == 0xFFFF || pci_dev.did == 0xFFFF)
+		sprintf(buf, "%s\n", pci_name(pci_dev.pdev));
 	else
 		sprintf(buf, "%04x:%04x\n", pci_dev.vid, pci_dev.did);
+	mutex_unlock(&fwdt_pci_lock);
 
 	return strlen(buf);
 }
 
+/*
+ * Select the target of pci_data either by VID:DID, which picks the first
+ * matching function, or by [segment:]bus:dev.fn. The device is resolved
+ * once here and kept referenced until the next selection.
+ */
 ssize_t pci_write_ids(struct device *dev, struct device_attribute *attr,
 		      const char *buf, size_t count)
 {
+	unsigned int segment = 0, bus, slot, fn;
 	unsigned int vendor_id, device_id;
+	struct pci_dev *pdev;
+	bool bdf;
+
+	bdf = sscanf(buf, "%x:%x:%x.%x", &segment, &bus, &slot, &fn) == 4;
+	if (!bdf) {
+		/* a partial match above may have stored into segment */
+		segment = 0;
+		bdf = sscanf(buf, "%x:%x.%x", &bus, &slot, &fn) == 3;
+	}
 
-	if (strlen(buf) > 10)
-		return 0;
+	if (bdf) {
+		if (segment > 0xFFFF || bus > 0xFF || slot > 0x1F || fn > 7)
+			return -EINVAL;
 
-	sscanf(buf, "%4x:%4x\n", &vendor_id, &device_id);
+		vendor_id = 0xFFFF;
+		device_id = 0xFFFF;
+		pdev = pci_get_domain_bus_and_slot(segment, bus,
+						   PCI_DEVFN(slot, fn));
+	} else if (sscanf(buf, "%4x:%4x", &vendor_id, &device_id) == 2) {
+		pdev = pci_get_device(vendor_id, device_id, NULL);
+	} else {
+		return -EINVAL;
+	}
+
+	if (!pdev) {
+		pr_info("pci device %s is not found\n", buf);
+		return -ENODEV;
+	}
 
+	mutex_lock(&fwdt_pci_lock);
+	pci_dev_put(pci_dev.pdev);
+	pci_dev.pdev = pdev;
 	pci_dev.did = device_id;
 	pci_dev.vid = vendor_id;
+	mutex_unlock(&fwdt_pci_lock);
 
 	return count;
 }
@@ -21,5 +21,6 @@
 #define u16 unsigned short
 #define u32 unsigned int
 #define u64 unsigned long
+#define s32 int
 
 #endif